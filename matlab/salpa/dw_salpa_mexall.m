@@ -5,8 +5,9 @@ a = which('dw_salpa_mexall');
 [b,~,~] = splitname(a);
 olddir = cd([b filesep 'private']);
 
-fprintf(1, 'Compiling salpamex.cpp LocalFit.cpp\n');
+fprintf(1, 'Compiling salpamex.cpp\n');
 
-mex salpamex.cpp LocalFit.cpp
+% The algorithm itself lives in the src directory of the salpa tree
+mex(['-I' fullfile(b, '..', '..', 'src')], 'salpamex.cpp');
 
 cd(olddir);
@@ -1,64 +1,56 @@
 // salpamex.C
 
 #if 0
-mex salpamex.cpp LocalFit.cpp
+mex -I../../../src salpamex.cpp
 #endif
 
 #include <mex.h>
-#include "LocalFit.h"
-#include <stdio.h>
-  
+#include "LocalFitBank.h"
+#include "LinBuf.h"
+
+template <typename Sample>
+void salpa(mxArray const *in, mxArray *out, double const *opts) {
+  timeref_t T = mxGetN(in) * mxGetM(in);
+  LinBuf<Sample> source(static_cast<Sample *>(mxGetData(in)), T);
+  LinBuf<Sample> dest(static_cast<Sample *>(mxGetData(out)), T);
+  BasicLocalFitBank<Sample, LinBuf<Sample>> bank(source, dest, 1, 0, 0,
+                                                 int(opts[3]),  // tau
+                                                 int(opts[4]),  // t_blankdepeg
+                                                 int(opts[5]),  // t_ahead
+                                                 int(opts[6])); // t_chi2
+  bank.setthreshold(0, opts[2]);
+  bank.setrail(0, opts[0], opts[1]); // +/-inf: no rail
+  bank.process(T);
+}
+
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
   /* Input arguments are:
-     data: Tx1 - Input
+     data: Tx1 - Input (double, single, or int16)
      opts: [ rail1, rail2, thresh, tau, t_blankdepeg, t_ahead, t_chi2 ]
      Output argument:
-     yy: Tx1 - Filtered output
+     yy: Tx1 - Filtered output, of the same class as the input
   */
-  double *data;
-  double *opts;
-  double *out;
-  int T;
-
-  { // Quick sanity check
-    timeref_t TEST = INFTY;
-    TEST++;
-    if (TEST!=0) {
-      printf("Warning! INFTY does not work on your platform. Please contact\nthe author, Daniel Wagenaar.\nFor contact information please visit http://www.danielwagenaar.net.\n");
-      return;
-    }
-    if (sizeof(timeref_t)<8) {
-      printf("Warning! I could not create an 8-bit integer type. Please contact\nthe author, Daniel Wagenaar.\nFor contact information please visit http://www.danielwagenaar.net.\n");
-      return;
-    }
-  }
-    
-  if(nrhs!=2) 
+  if(nrhs!=2)
     mexErrMsgTxt("Two inputs required.");
-  if(nlhs!=1) 
+  if(nlhs!=1)
     mexErrMsgTxt("One output required.");
-  
-  /* Check to make sure the first_gt input argument is a vector. */
-  if (!mxIsDouble(prhs[0]) || mxIsComplex(prhs[0]) ||
-      (mxGetN(prhs[0])>1 && mxGetM(prhs[0])>1))
-    mexErrMsgTxt("Input 1 must be a real vector.");
+
+  mxClassID cls = mxGetClassID(prhs[0]);
+  if ((cls!=mxDOUBLE_CLASS && cls!=mxSINGLE_CLASS && cls!=mxINT16_CLASS)
+      || mxIsComplex(prhs[0])
+      || (mxGetN(prhs[0])>1 && mxGetM(prhs[0])>1))
+    mexErrMsgTxt("Input 1 must be a real vector of class double, single, or int16.");
   if (!mxIsDouble(prhs[1]) || mxIsComplex(prhs[1]) ||
-      mxGetN(prhs[1])*mxGetM(prhs[1])!=7) 
+      mxGetN(prhs[1])*mxGetM(prhs[1])!=7)
     mexErrMsgTxt("Input 2 must be a real vector of 7 elements.");
 
-  plhs[0] = mxCreateDoubleMatrix(mxGetM(prhs[0]),mxGetN(prhs[0]),mxREAL);
+  plhs[0] = mxCreateNumericMatrix(mxGetM(prhs[0]), mxGetN(prhs[0]),
+                                  cls, mxREAL);
+  double const *opts = mxGetPr(prhs[1]);
 
-  T=mxGetN(prhs[0]) * mxGetM(prhs[0]);
-  data=mxGetPr(prhs[0]);
-  opts=mxGetPr(prhs[1]);
-  out=mxGetPr(plhs[0]);
-
-  LocalFit lf(data,out,0,T,
-	      opts[2],  // threshold
-	      int(opts[3]),  // tau
-	      int(opts[4]),  // t_blankdepeg
-	      int(opts[5]),  // t_ahead
-	      int(opts[6])); // t_chi2
-  lf.setrail(opts[0],opts[1]);
-  lf.process(T);
+  switch (cls) {
+  case mxINT16_CLASS: salpa<std::int16_t>(prhs[0], plhs[0], opts); break;
+  case mxSINGLE_CLASS: salpa<float>(prhs[0], plhs[0], opts); break;
+  default: salpa<double>(prhs[0], plhs[0], opts); break;
+  }
 }
@@ -3,10 +3,14 @@ function yy = salpa(xx,varargin)
 %   This is the algorithm described in Wagenaar & Potter, 2002. 
 %   yy = SALPA(xx) runs SALPA with default arguments.
 %   yy = SALPA(xx, key1,val1, ...) specifies options:
+%   XX may be of class double, single, or int16; YY has the same class.
+%   Blanked samples are NaN, or zero for int16.
 %
 %     tau          - half width of filter window (default: 30 samples)
 %     threshold    - threshold for depegging (default: inf)
 %     rails [2x1]  - sample values for pegging (default: [-inf inf])
+%   Samples at or beyond either rail are pegged; an infinite rail never
+%   pegs. (Earlier versions pegged only samples exactly equal to a rail.)
 %     t_blankdepeg - number of samples before depeg (default: 5)
 %     t_ahead      - number of samples to look ahead (default: 5)
 %     t_chi2       - number of samples for quality test (default: 15)
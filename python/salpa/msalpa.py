@@ -7,15 +7,18 @@ import os
 class Salpa:
     def __init__(self, data, tau, rail1=-np.inf, rail2=np.inf, thresh=np.inf,
                  t_blankdepeg=5, t_ahead=5, t_chi2=15):
-        self.data = data.astype(np.float32)
-        N = len(data)
-        self.out = np.zeros(N, np.float32)
+        # int16 and float32 data are processed in place, without a copy;
+        # anything else is converted to float32 first.
+        data = np.asarray(data)
+        if data.dtype != np.int16:
+            data = data.astype(np.float32, copy=False)
+        self.data = np.ascontiguousarray(data)
+        N = len(self.data)
+        self.out = np.zeros(N, self.data.dtype)
         self.csalpa = salpa_cppcore.csalpa(self.data,
                                            self.out,
-                                           thresh, tau)
-        self.csalpa.set_t_blankdepeg(t_blankdepeg)
-        self.csalpa.set_t_ahead(t_ahead)
-        self.csalpa.set_t_chi2(t_chi2)
+                                           thresh, tau,
+                                           t_blankdepeg, t_ahead, t_chi2)
         self.csalpa.setrail(rail1, rail2)
     def complete(self):
         self.partial(len(self.data))
@@ -34,6 +37,12 @@ def salpa(data, tau, rail1=-np.inf, rail2=np.inf, thresh=np.inf,
     y = SALPA(x, tau) performs SALPA on the data X, which must be a 1D
     numpy array. Note that THRESH is absolute. You need to estimate the noise
     level with an external tool.
+    Data of type int16 or float32 are processed without conversion, and
+    the result has the same type. Other types are converted to float32.
+    Blanked samples are NaN in float results and zero in int16 results.
+    Samples at or beyond RAIL1 or RAIL2 are pegged; an infinite rail
+    never pegs. (The Matlab version used to peg only samples exactly
+    equal to a rail; it now behaves like this one.)
     See Wagenaar and Potter (2001).'''
     slp = Salpa(data, tau, rail1, rail2, thresh, t_blankdepeg, t_ahead, t_chi2)
     if tt_stimuli is not None:
@@ -1,34 +1,71 @@
-// salpapy.cpp
+// salpa_cppcore.cpp
 
-#include "LocalFit.h"
+/* Python binding for the same LocalFitBank that the command line
+   program uses. It operates directly on the caller's numpy arrays,
+   which must be one-dimensional and contiguous, and either int16 or
+   float32; msalpa.py takes care of that.
+*/
+
+#include "LocalFitBank.h"
+#include "LinBuf.h"
 
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
+#include <stdexcept>
 
 namespace py = pybind11;
 
+template <typename Sample> class PySalpa {
+public:
+  typedef py::array_t<Sample, py::array::c_style> Array;
+  typedef BasicLocalFitBank<Sample, LinBuf<Sample>> Bank;
+public:
+  PySalpa(Array in0, Array out0, double thresh, int tau,
+          int t_blankdepeg, int t_ahead, int t_chi2):
+    in(in0), out(out0),
+    source(const_cast<Sample *>(in.data()), in.size()),
+    dest(out.mutable_data(), out.size()),
+    bank(source, dest, 1, 0, 0, tau, t_blankdepeg, t_ahead, t_chi2) {
+    bank.setthreshold(0, thresh);
+  }
+  void reset(timeref_t t_start) { bank.reset(t_start); }
+  void setrail(double r1, double r2) {
+    bank.setrail(0, r1, r2);
+  }
+  timeref_t process(timeref_t t_limit) { return bank.process(t_limit); }
+  timeref_t forcepeg(timeref_t t_from, timeref_t t_to) {
+    return bank.forcepeg(t_from, t_to);
+  }
+private:
+  Array in, out; // keep the numpy arrays alive as long as we are
+  LinBuf<Sample> source, dest;
+  Bank bank;
+};
+
+template <typename Sample>
+void defsalpa(py::module &m, char const *name) {
+  py::class_<PySalpa<Sample>>(m, name)
+    .def("reset", &PySalpa<Sample>::reset, py::arg("t_start")=0)
+    .def("setrail", &PySalpa<Sample>::setrail)
+    .def("process", &PySalpa<Sample>::process)
+    .def("forcepeg", &PySalpa<Sample>::forcepeg);
+  m.def("csalpa", [](typename PySalpa<Sample>::Array in,
+                     typename PySalpa<Sample>::Array out,
+                     double thresh, int tau,
+                     int t_blankdepeg, int t_ahead, int t_chi2) {
+          if (in.ndim()!=1 || out.ndim()!=1 || out.size()!=in.size())
+            throw std::invalid_argument("salpa: input and output must be"
+                                        " 1D arrays of equal length");
+          return new PySalpa<Sample>(in, out, thresh, tau,
+                                     t_blankdepeg, t_ahead, t_chi2); },
+    py::arg("in"), py::arg("out"), py::arg("thresh"), py::arg("tau"),
+    py::arg("t_blankdepeg")=5, py::arg("t_ahead")=5, py::arg("t_chi2")=15);
+}
+
 PYBIND11_MODULE(salpa_cppcore, m) {
   m.doc() = "SALPA plugin";
-  py::class_<LocalFit>(m, "Salpa")
-    //    .def(py::init<raw_t const *, raw_t *, timeref_t, raw_t, int>())
-    .def("reset", &LocalFit::reset)
-    .def("set_t_blankdepeg", &LocalFit::set_t_blankdepeg)
-    .def("set_t_ahead", &LocalFit::set_t_ahead)
-    .def("set_t_chi2", &LocalFit::set_t_chi2)
-    .def("setrail", &LocalFit::setrail)
-    .def("process", &LocalFit::process)
-    .def("forcepeg", &LocalFit::forcepeg);
-  m.def("isvalid", []() { return LocalFit::isValid(); });
-  m.def("csalpa", [](py::array_t<float_t, py::array::c_style> in,
-                     py::array_t<float, py::array::c_style> out,
-                     float thresh, int tau) {
-    auto in_ = in.request();    
-    auto out_ = out.request();    
-    return new LocalFit(static_cast<float *>(in_.ptr),
-                        static_cast<float *>(out_.ptr),
-                        in_.shape[0],
-                        thresh,
-                        tau); });
+  defsalpa<std::int16_t>(m, "SalpaInt16");
+  defsalpa<float>(m, "SalpaFloat32");
+  m.def("isvalid", []() {
+      return timeref_t(INFTY + 1)==0 && sizeof(timeref_t)==8; });
 }
-
-
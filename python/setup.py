@@ -1,7 +1,23 @@
 from pybind11.setup_helpers import Pybind11Extension
 from setuptools import setup
+from pathlib import Path
+import shutil
+
+# The algorithm lives in ../src, shared with the command line program
+# and the Matlab mex file. Take a copy of the headers while we are in
+# the repository, so that the sdist (and cibuildwheel's container,
+# which only sees this directory) can do without it.
+here = Path(__file__).parent
+core = here / "salpa" / "core"
+src = here.parent / "src"
+if (src / "LocalFitBank.h").exists():
+    core.mkdir(exist_ok=True)
+    for hdr in ["LocalFitBank.h", "CyclBuf.h", "LinBuf.h", "Trace.h"]:
+        shutil.copy(src / hdr, core / hdr)
 
 setup(ext_modules=[
     Pybind11Extension("salpa_cppcore",
-                      ["salpa/salpa_cppcore.cpp", "salpa/LocalFit.cpp"])
+                      ["salpa/salpa_cppcore.cpp"],
+                      include_dirs=["salpa/core"],
+                      cxx_std=11)
     ])
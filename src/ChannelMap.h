@@ -0,0 +1,165 @@
+// ChannelMap.h
+
+#ifndef CHANNELMAP_H
+
+#define CHANNELMAP_H
+
+/* A ChannelMap says what salpa does with each channel of a scan in the
+   file: FIT it with LocalFit, PASS it through verbatim, or DROP it
+   from the output.
+
+   Inside salpa, a scan holds the fitted channels first and the passed
+   ones after them, each in file order; dropped channels are not kept
+   at all. Each kept channel thus has a SLOT. UNPACK converts scans from
+   the file layout to slots, and PACK converts slots to the output
+   layout, which is the file layout without the dropped channels.
+   Without a map, the first NFIT channels are fitted and the rest
+   passed, so that nothing needs converting (IDENTITY).
+
+   PARSE takes a list of items separated by commas or white space,
+   each a channel or range of channels (counting from zero) followed
+   by ":f", ":p", or ":d"; for instance, "0-59:f,60-63:p,64-65:d".
+   Channels that are not mentioned are passed through; later items
+   override earlier ones. If the argument names a file, the list is
+   read from there, and "#" starts a comment that runs to the end of
+   the line.
+*/
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include "LocalFitBank.h"
+
+class ChannelMap {
+public:
+  enum class Role { FIT, PASS, DROP };
+public:
+  ChannelMap(int nfit=0, int nfile=0) {
+    std::vector<Role> roles(nfile, Role::PASS);
+    for (int c=0; c<nfit && c<nfile; c++)
+      roles[c] = Role::FIT;
+    build(roles);
+  }
+  bool parse(char const *spec, int nfile) {
+    // Returns false, after complaining, if SPEC makes no sense.
+    std::string text = spec;
+    if (FILE *f = std::fopen(spec, "r")) {
+      text.clear();
+      bool comment = false;
+      int ch;
+      while ((ch = std::fgetc(f)) != EOF) {
+        if (ch=='#')
+          comment = true;
+        else if (ch=='\n')
+          comment = false;
+        text += comment ? ' ' : char(ch);
+      }
+      std::fclose(f);
+    }
+    std::vector<Role> roles(nfile, Role::PASS);
+    char const *s = text.c_str();
+    while (true) {
+      while (*s==',' || std::isspace((unsigned char)*s))
+        s++;
+      if (!*s)
+        break;
+      char *e;
+      long a = std::strtol(s, &e, 10);
+      long b = a;
+      if (e>s && *e=='-')
+        b = std::strtol(e+1, &e, 10);
+      if (e==s || *e!=':' || a<0 || b<a || b>=nfile) {
+        std::cerr << "Bad channel map item: "
+                  << std::string(s).substr(0, 20) << "\n";
+        return false;
+      }
+      Role role;
+      switch (e[1]) {
+      case 'f': role = Role::FIT; break;
+      case 'p': role = Role::PASS; break;
+      case 'd': role = Role::DROP; break;
+      default:
+        std::cerr << "Bad channel role in map: "
+                  << std::string(s).substr(0, 20) << "\n";
+        return false;
+      }
+      for (long c=a; c<=b; c++)
+        roles[c] = role;
+      s = e + 2;
+    }
+    build(roles);
+    return true;
+  }
+  int filecount() const { return nfile; }
+  int fitcount() const { return nfit; }
+  int keepcount() const { return from.size(); }
+  bool identity() const { return ident; }
+  int slot(int filechan) const {
+    // The slot of channel FILECHAN in the file, or -1 if it is dropped.
+    for (unsigned k=0; k<from.size(); k++)
+      if (from[k]==filechan)
+        return k;
+    return -1;
+  }
+  int filechannel(int slot) const {
+    return from[slot];
+  }
+  void unpack(raw_t const *src, raw_t *dst, int dststep, int n) const {
+    /* Converts N scans from the file layout at SRC to slots at DST,
+       with scans DSTSTEP apart there.
+    */
+    int nkeep = from.size();
+    for (int k=0; k<n; k++) {
+      for (int s=0; s<nkeep; s++)
+        dst[s] = src[from[s]];
+      src += nfile;
+      dst += dststep;
+    }
+  }
+  void pack(raw_t const *src, int srcstep, raw_t *dst, int n) const {
+    /* Converts N scans from slots at SRC, with scans SRCSTEP apart, to
+       the output layout at DST.
+    */
+    int nkeep = from.size();
+    for (int k=0; k<n; k++) {
+      for (int j=0; j<nkeep; j++)
+        dst[j] = src[outslot[j]];
+      src += srcstep;
+      dst += nkeep;
+    }
+  }
+private:
+  void build(std::vector<Role> const &roles) {
+    nfile = roles.size();
+    from.clear();
+    for (int c=0; c<nfile; c++)
+      if (roles[c]==Role::FIT)
+        from.push_back(c);
+    nfit = from.size();
+    for (int c=0; c<nfile; c++)
+      if (roles[c]==Role::PASS)
+        from.push_back(c);
+    outslot = std::vector<int>(from.size());
+    ident = int(from.size())==nfile;
+    for (unsigned s=0; s<from.size(); s++) {
+      int j = 0; // position in output
+      for (int c=0; c<from[s]; c++)
+        if (roles[c]!=Role::DROP)
+          j++;
+      outslot[j] = s;
+      if (from[s]!=int(s))
+        ident = false;
+    }
+  }
+private:
+  int nfile;
+  int nfit;
+  std::vector<int> from; // file channel for each slot
+  std::vector<int> outslot; // slot for each channel of the output
+  bool ident;
+};
+
+#endif
@@ -6,34 +6,148 @@
 
 #include <vector>
 #include <cstdint>
+#include <cstddef>
 
-template <class T> class CyclBuf {
+template <int Stride> struct CyclStride {
+  // stride known at compile time, so index arithmetic folds away
+  CyclStride(int) { }
+  operator int() const { return Stride; }
+};
+
+template <> struct CyclStride<0> {
+  // stride known only at run time
+  CyclStride(int stride): stride(stride) { }
+  operator int() const { return stride; }
+  int stride;
+};
+
+/* A CyclBuf presents a ring of 2^LOG2SIZE elements, STRIDE apart in
+   memory, as an infinitely long array. STRIDE may be fixed at compile
+   time through the template parameter; the default (0) takes it from
+   the constructor. For the interleaved layout that salpa uses, each
+   channel has a buffer whose stride equals the number of channels in
+   a scan.
+
+   If the memory behind the ring is mapped twice, back to back (see
+   BigBuf in Placement.h), the buffer is MIRRORED: any stretch of up to
+   the full size is then contiguous, even across the wrap point, so
+   SPANS never needs to split it.
+*/
+
+template <class T, int Stride=0> class CyclBuf {
+ public:
+  static constexpr bool bounded = false; // see LinBuf.h
+  struct Span {
+    T *data; // first element; subsequent ones are step() apart
+    int count;
+  };
  public:
   CyclBuf(int log2size=16):
-    stride(1) {
+    stride(Stride ? Stride : 1), log2size(log2size), mirror(false) {
     int size = 1 << log2size;
     mask = size - 1;
-    vec = std::vector<T>(size, 0);
+    vec = std::vector<T>(size * int(stride), 0);
     data = vec.data();
   }
-  CyclBuf(T *data, int log2size, int stride=1):
-    data(data), stride(stride) {
+  CyclBuf(T *data, int log2size, int stride=Stride ? Stride : 1,
+          bool mirrored=false):
+    data(data), stride(stride), log2size(log2size), mirror(mirrored) {
     int size = 1 << log2size;
     mask = size - 1;
   }
   T const &operator[](std::uint32_t index) const {
     index &= mask;
-    return data[index*stride];
+    return data[std::size_t(index)*stride];
   }
   T &operator[](std::uint32_t index) {
     index &= mask;
-    return data[index*stride];
+    return data[std::size_t(index)*stride];
+  }
+  std::uint64_t end() const { return ~std::uint64_t(0); }
+  int size() const { return mask + 1; }
+  int step() const { return stride; }
+  bool mirrored() const { return mirror; }
+  int contiguous(std::uint32_t index, int count) const {
+    /* Returns how many of the COUNT elements starting at INDEX can be
+       reached by stepping a pointer from &(*this)[INDEX]: those before
+       the wrap point, or up to a full ring if the buffer is mirrored.
+    */
+    int k = mirror ? mask + 1 : mask + 1 - (index & mask);
+    return k < count ? k : count;
+  }
+  int spans(std::uint32_t index, int count, Span span[2]) const {
+    /* Describes COUNT elements starting at INDEX as (at most two)
+       pieces of memory in which elements are step() apart, so that
+       loops over them need no masking. Returns the number of pieces.
+       COUNT must not exceed the size of the buffer.
+    */
+    int n = 0;
+    while (count>0) {
+      index &= mask;
+      int k = mirror ? count : mask + 1 - index;
+      if (k > count)
+        k = count;
+      span[n].data = data + std::size_t(index)*stride;
+      span[n].count = k;
+      n++;
+      index += k;
+      count -= k;
+    }
+    return n;
+  }
+  void read(T *dst, std::uint32_t index, int count) const {
+    // Copies COUNT elements starting at INDEX to a plain array.
+    while (count>0) {
+      Span sp[2];
+      int n = spans(index, count > int(mask) ? mask + 1 : count, sp);
+      for (int s=0; s<n; s++) {
+        for (int k=0; k<sp[s].count; k++)
+          dst[k] = sp[s].data[std::size_t(k)*stride];
+        dst += sp[s].count;
+        index += sp[s].count;
+        count -= sp[s].count;
+      }
+    }
+  }
+  void write(std::uint32_t index, T const *src, int count) {
+    // Copies COUNT elements from a plain array to INDEX and onward.
+    while (count>0) {
+      Span sp[2];
+      int n = spans(index, count > int(mask) ? mask + 1 : count, sp);
+      for (int s=0; s<n; s++) {
+        for (int k=0; k<sp[s].count; k++)
+          sp[s].data[std::size_t(k)*stride] = src[k];
+        src += sp[s].count;
+        index += sp[s].count;
+        count -= sp[s].count;
+      }
+    }
+  }
+  void fill(std::uint32_t index, T value, int count) {
+    // Sets COUNT elements starting at INDEX to VALUE.
+    while (count>0) {
+      Span sp[2];
+      int n = spans(index, count > int(mask) ? mask + 1 : count, sp);
+      for (int s=0; s<n; s++) {
+        for (int k=0; k<sp[s].count; k++)
+          sp[s].data[std::size_t(k)*stride] = value;
+        index += sp[s].count;
+        count -= sp[s].count;
+      }
+    }
+  }
+  CyclBuf view(int offset=0) const {
+    // A non-owning buffer into the same memory, shifted by OFFSET elements.
+    // Useful for addressing individual channels of an interleaved buffer.
+    return CyclBuf(data + offset, log2size, stride, mirror);
   }
  private:
   std::vector<T> vec;
   T *data;
-  std::uint32_t stride;
+  CyclStride<Stride> stride;
+  int log2size;
   std::uint32_t mask;
+  bool mirror;
 };
 
 #endif
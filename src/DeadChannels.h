@@ -0,0 +1,111 @@
+// DeadChannels.h
+
+#ifndef DEADCHANNELS_H
+
+#define DEADCHANNELS_H
+
+#include <vector>
+#include "CyclBuf.h"
+#include "LocalFitBank.h"
+
+/* DeadChannels finds electrode channels that carry no signal: those
+   that are stuck at a constant value (typically a rail) or that vary
+   by no more than RANGE digital units. Such channels are not worth
+   running through LocalFit; they are put in state DEAD instead.
+
+   WATCH follows the minimum and maximum of each channel over the
+   interleaved rows of a buffer as data arrives. A live channel is
+   judged dead if it stayed within RANGE for at least one PERIOD of
+   scans, as of a REVIEW; WATCH holds a review at every multiple of
+   PERIOD, counted from OFFSET scans before the start of the buffer
+   (so that segments of a recording review at the same scans as a
+   single pass would). A dead channel comes back to life as soon as
+   WATCH sees it leave its range, so that no real signal gets zeroed.
+   APPLY passes the verdicts to the fitters, but kills a channel only
+   once processing has reached the start of its flat stretch.
+*/
+
+class DeadChannels {
+public:
+  DeadChannels(int nchans, int range, timeref_t period,
+               timeref_t offset=0):
+    range(range), period(period), offset(offset), watched(0),
+    lo(nchans), hi(nchans), since(nchans, 0),
+    dead(nchans, 0), ever(nchans, 0) {
+    for (int c=0; c<nchans; c++)
+      restart(c, 0);
+  }
+  void watch(CyclBuf<raw_t> const &rows, timeref_t t_to) {
+    int nchans = lo.size();
+    raw_t *l = lo.data();
+    raw_t *h = hi.data();
+    while (watched < t_to) {
+      timeref_t t_end = ((offset + watched)/period + 1)*period - offset;
+      if (t_end > t_to)
+        t_end = t_to;
+      int count = rows.contiguous(watched, t_end - watched);
+      raw_t const *y = &rows[watched];
+      for (int k=0; k<count; k++) {
+        for (int c=0; c<nchans; c++) {
+          l[c] = y[c] < l[c] ? y[c] : l[c];
+          h[c] = y[c] > h[c] ? y[c] : h[c];
+        }
+        y += rows.step();
+      }
+      watched += count;
+      if ((offset + watched) % period == 0)
+        review(watched, period);
+    }
+    for (int c=0; c<nchans; c++)
+      if (dead[c] && hi[c] - lo[c] > range)
+        restart(c, watched);
+  }
+  void review(timeref_t t, timeref_t minspan) {
+    /* Judges live channels that have been watched for at least MINSPAN
+       scans as of T, and starts afresh on those that are not dead.
+    */
+    for (unsigned c=0; c<lo.size(); c++) {
+      if (dead[c] || t - since[c] < minspan)
+        continue;
+      if (hi[c] - lo[c] <= range)
+        dead[c] = ever[c] = 1;
+      else
+        restart(c, t);
+    }
+  }
+  int apply(LocalFitBank &fitters, timeref_t t_processed) const {
+    // Returns the number of channels that died or came back to life.
+    int n = 0;
+    for (unsigned c=0; c<lo.size(); c++) {
+      if (dead[c] && !fitters.dead(c) && t_processed >= since[c]) {
+        fitters.setdead(c, true);
+        n++;
+      } else if (!dead[c] && fitters.dead(c)) {
+        fitters.setdead(c, false);
+        n++;
+      }
+    }
+    return n;
+  }
+  bool everdead(int c) const {
+    return ever[c];
+  }
+private:
+  void restart(int c, timeref_t t) {
+    lo[c] = 32767;
+    hi[c] = -32768;
+    since[c] = t;
+    dead[c] = 0;
+  }
+private:
+  int range;
+  timeref_t period;
+  timeref_t offset; // scans before the start of the buffer
+  timeref_t watched; // rows up to here have been seen
+  std::vector<raw_t> lo, hi; // extremes since SINCE
+  std::vector<timeref_t> since;
+  std::vector<char> dead;
+  std::vector<char> ever; // ever judged dead
+};
+
+#endif
@@ -0,0 +1,83 @@
+// Doorbell.h
+
+#ifndef DOORBELL_H
+
+#define DOORBELL_H
+
+/* Low-level waiting between threads that otherwise only share atomic
+   counters: CPUPAUSE for spinning, and sleeping on a futex. On systems
+   other than Linux, sleeping degrades to yielding.
+
+   A Doorbell is how one thread tells another that something it may be
+   waiting for has changed. The waiting side takes a PEEK before it
+   looks at the shared state and, if there is nothing for it to do,
+   WAITs for the count to move on from there; so a RING in between is
+   never missed.
+*/
+
+#include <atomic>
+#include <thread>
+#include <climits>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+inline void cpupause() {
+#if defined(__SSE2__)
+  _mm_pause();
+#endif
+}
+
+inline void futexwait(std::atomic<int> &word, int value) {
+  // Sleeps until WORD may no longer hold VALUE.
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<int *>(&word), FUTEX_WAIT_PRIVATE,
+          value, 0, 0, 0);
+#else
+  (void)word;
+  (void)value;
+  std::this_thread::yield();
+#endif
+}
+
+inline void futexwake(std::atomic<int> &word) {
+  // Wakes all threads sleeping on WORD.
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<int *>(&word), FUTEX_WAKE_PRIVATE,
+          INT_MAX, 0, 0, 0);
+#else
+  (void)word;
+#endif
+}
+
+class Doorbell {
+public:
+  Doorbell(): rings(0), sleepers(0) { }
+  int peek() const {
+    return rings.load();
+  }
+  void ring() {
+    rings++;
+    if (sleepers.load())
+      futexwake(rings);
+  }
+  void wait(int seen) {
+    // Returns once RING has been called since PEEK returned SEEN.
+    while (rings.load()==seen) {
+      sleepers++;
+      if (rings.load()==seen)
+        futexwait(rings, seen);
+      sleepers--;
+    }
+  }
+private:
+  std::atomic<int> rings;
+  std::atomic<int> sleepers;
+};
+
+#endif
@@ -0,0 +1,143 @@
+// EventDetector.h
+
+#ifndef EVENTDETECTOR_H
+
+#define EVENTDETECTOR_H
+
+#include <vector>
+#include "CyclBuf.h"
+
+/* An EventDetector finds the times at which salpa should force a peg
+   on all channels, while the data passes through salpa anyway, so that
+   no separate pass over the recording is needed to produce a -P file.
+   It works in one of two ways:
+
+   - TRIGGER: an event happens whenever the given channel (typically
+     an auxiliary channel carrying the stimulus TTL) crosses the
+     threshold, upward for a positive threshold, downward for a
+     negative one.
+
+   - CONSENSUS: an event happens when at least COUNT electrode channels
+     hit their rails within WINDOW samples of one another. The event is
+     placed at the first of those rail hits, but no earlier than WINDOW
+     samples before the hit that completes the count.
+
+   SCAN works on the interleaved rows of a buffer and remembers how far
+   it got, so it can be called again as more data arrives. After salpa
+   has handled an event, RESTART moves the scan past the forced peg.
+*/
+
+class EventDetector {
+public:
+  EventDetector(): mode(NONE), scanned(0) { }
+  void settrigger(int channel, raw_t threshold) {
+    mode = TRIGGER;
+    trigchan = channel;
+    trigthresh = threshold;
+    primed = false;
+  }
+  void setconsensus(int count, int window,
+                    std::vector<raw_t> const &r1,
+                    std::vector<raw_t> const &r2) {
+    mode = CONSENSUS;
+    mincount = count;
+    this->window = window;
+    rail1 = r1;
+    rail2 = r2;
+    until = std::vector<timeref_t>(r1.size(), 0);
+    onset = std::vector<timeref_t>(r1.size(), 0);
+  }
+  bool active() const {
+    return mode != NONE;
+  }
+  timeref_t scan(CyclBuf<raw_t> const &rows, timeref_t t_to) {
+    /* Scans the rows up to T_TO. Returns the time of the first event,
+       or INFTY if there is none up to T_TO.
+    */
+    return mode==TRIGGER ? scantrigger(rows, t_to)
+      : mode==CONSENSUS ? scanconsensus(rows, t_to)
+      : INFTY;
+  }
+  timeref_t settled() const {
+    /* Returns the time before which SCAN will not report any further
+       events. Processing must not go beyond this point before the
+       next call to SCAN.
+    */
+    if (mode==CONSENSUS)
+      return scanned > timeref_t(window) ? scanned - window : 0;
+    return scanned;
+  }
+  void restart(timeref_t t) {
+    // Ignores anything before T.
+    if (scanned < t)
+      scanned = t;
+    primed = false;
+    for (timeref_t &u: until)
+      u = 0;
+  }
+private:
+  timeref_t scantrigger(CyclBuf<raw_t> const &rows, timeref_t t_to) {
+    for (; scanned<t_to; scanned++) {
+      raw_t y = (&rows[scanned])[trigchan];
+      bool beyond = trigthresh>=0 ? y>=trigthresh : y<=trigthresh;
+      bool crossing = primed && beyond && !above;
+      above = beyond;
+      primed = true;
+      if (crossing)
+        return scanned++;
+    }
+    return INFTY;
+  }
+  timeref_t scanconsensus(CyclBuf<raw_t> const &rows, timeref_t t_to) {
+    int nchans = rail1.size();
+    raw_t const *r1 = rail1.data();
+    raw_t const *r2 = rail2.data();
+    for (; scanned<t_to; scanned++) {
+      raw_t const *y = &rows[scanned];
+      char any = 0;
+      for (int c=0; c<nchans; c++)
+        any |= (y[c]<=r1[c]) | (y[c]>=r2[c]);
+      if (!any)
+        continue; // no new hits, so the count cannot go up
+      timeref_t t = scanned;
+      int count = 0;
+      timeref_t first = t;
+      for (int c=0; c<nchans; c++) {
+        if ((y[c]<=r1[c]) | (y[c]>=r2[c])) {
+          if (until[c] <= t)
+            onset[c] = t;
+          until[c] = t + window;
+        }
+        if (until[c] > t) {
+          count++;
+          if (onset[c] < first)
+            first = onset[c];
+        }
+      }
+      if (count >= mincount) {
+        // a channel that stays on the rail does not date the event back
+        if (first + window <= t)
+          first = t - window + 1;
+        scanned++;
+        return first;
+      }
+    }
+    return INFTY;
+  }
+private:
+  enum { NONE, TRIGGER, CONSENSUS } mode;
+  timeref_t scanned; // rows before this have been looked at
+  // trigger
+  int trigchan;
+  raw_t trigthresh;
+  bool primed; // whether ABOVE is known
+  bool above;
+  // consensus
+  int mincount;
+  int window;
+  std::vector<raw_t> rail1, rail2;
+  std::vector<timeref_t> until; // channel counts until this time
+  std::vector<timeref_t> onset; // first hit in the current stretch
+};
+
+#endif
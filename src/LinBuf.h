@@ -0,0 +1,75 @@
+// LinBuf.h
+
+#ifndef LINBUF_H
+
+#define LINBUF_H
+
+#include <cstdint>
+
+/* A LinBuf presents a plain array of LENGTH samples (with the given
+   stride between samples) with the same interface as a CyclBuf, so
+   that LocalFitBank can work directly on arrays owned by Python or
+   Matlab. Reading beyond either end yields zero, and writing there is
+   silently ignored; LocalFitBank treats everything from END() on as
+   pegged, so those values never make it into the output.
+*/
+
+template <class T> class LinBuf {
+public:
+  static constexpr bool bounded = true;
+public:
+  LinBuf(T *data, std::uint64_t length, int stride=1):
+    data(data), length(length), stride(stride), zero(0), junk(0) {
+  }
+  T const &operator[](std::uint64_t index) const {
+    return index<length ? data[index*stride] : zero;
+  }
+  T &operator[](std::uint64_t index) {
+    return index<length ? data[index*stride] : junk;
+  }
+  std::uint64_t end() const { return length; }
+  int step() const { return stride; }
+  void read(T *dst, std::uint64_t index, int count) const {
+    // Copies COUNT elements starting at INDEX to a plain array.
+    for (int k=0; k<count; k++)
+      dst[k] = (*this)[index + k];
+  }
+  void write(std::uint64_t index, T const *src, int count) {
+    // Copies COUNT elements from a plain array to INDEX and onward.
+    if (index>=length)
+      return;
+    if (length - index < std::uint64_t(count))
+      count = length - index;
+    T *dst = data + index*stride;
+    for (int k=0; k<count; k++)
+      dst[k*stride] = src[k];
+  }
+  void fill(std::uint64_t index, T value, int count) {
+    // Sets COUNT elements starting at INDEX to VALUE.
+    if (index>=length)
+      return;
+    if (length - index < std::uint64_t(count))
+      count = length - index;
+    T *dst = data + index*stride;
+    for (int k=0; k<count; k++)
+      dst[k*stride] = value;
+  }
+  int contiguous(std::uint64_t index, int count) const {
+    // Returns how many of COUNT elements from INDEX lie within the array.
+    if (index>=length)
+      return 0;
+    return length - index < std::uint64_t(count) ? length - index : count;
+  }
+  LinBuf<T> view(int offset=0) const {
+    // A buffer into the same memory, shifted by OFFSET elements.
+    return LinBuf<T>(data + offset, length, stride);
+  }
+private:
+  T *data;
+  std::uint64_t length;
+  std::uint64_t stride;
+  T zero;
+  T junk;
+};
+
+#endif
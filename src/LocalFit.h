@@ -27,112 +27,46 @@
    centered at zero initially. This is problematic with 64-bit integer
    calculations from tau>=55 if the baseline is as large as 4096, or
    for tau>=57 if the baseline is 2048.
- * Bottom line: *ALWAYS* remove baseline before passing data in.
- * Perhaps the real solution is to re-do the math with X0 subtracted from
-   X1..X3.
+ * LocalFitBank now works out from tau which products could overflow
+   64 bits for any 16-bit data, and does those in 128-bit arithmetic
+   (see LocalFitBank::accumulator()). Baseline removal is no longer
+   needed for correctness, except on compilers without 128-bit
+   integers (MSVC), where the warning above still applies.
 */
 
-#include <cstdint>
-#include "CyclBuf.h"
+#include "LocalFitBank.h"
 
-typedef std::int16_t raw_t;
-typedef std::uint64_t timeref_t;
-constexpr timeref_t INFTY = ~0;
+/* LocalFit is the single-channel interface to the algorithm. The
+   actual work is done by a LocalFitBank with one channel.
+*/
 
 class LocalFit {
 public:
-  typedef double real_t;
-  typedef std::int64_t int_t;
-public:
-  enum class State {
-    OK,
-    PEGGING,
-    PEGGED,
-    TOOPOOR,
-    DEPEGGING,
-    FORCEPEG,
-    BLANKDEPEG
-  };
-  /* State variables kept in each state:
-
-    	 var\state OK PEGGING PEGGED TOOPOOR DEPEGGING FORCEPEG BLANKDEPEG
-    		   -- ------- ------ ------- --------- -------- ----------
-    	 t_stream   y    y      y      y        y         y         y     
-    	 t_0        *    y      *      y        y         +         y     
-    	 X_0..2     y    y      n      y        y         n         y     
-    	 X_3        n    y      n      y        y         n         y     
-    	 alpha_0..3 n    y      n      y        y         n         y     
-         toopoorcnt n    n      n      y        n         n         n     
-	 
-     *: t_0 is implicitly equal to t_stream and not kept
-     +: t_0 is used to mark end of forced peg
-  */
-  static constexpr raw_t RAIL1=-30000;
-  static constexpr raw_t RAIL2=30000;
-  static constexpr timeref_t TCHI2=15; // samples
-  static constexpr timeref_t BLANKDEP=5; // samples
-  static constexpr timeref_t AHEAD=5; // samples
-  static constexpr timeref_t TOOPOORCNT=5;
+  typedef LocalFitBank::State State;
+  static constexpr raw_t RAIL1=LocalFitBank::RAIL1;
+  static constexpr raw_t RAIL2=LocalFitBank::RAIL2;
+  static constexpr timeref_t TCHI2=LocalFitBank::TCHI2; // samples
+  static constexpr timeref_t BLANKDEP=LocalFitBank::BLANKDEP; // samples
+  static constexpr timeref_t AHEAD=LocalFitBank::AHEAD; // samples
+  static constexpr timeref_t TOOPOORCNT=LocalFitBank::TOOPOORCNT;
 public:
   LocalFit(CyclBuf<raw_t> const &source, CyclBuf<raw_t> &dest,
 	   timeref_t t_start, raw_t threshold, timeref_t tau,
 	   timeref_t t_blankdepeg=BLANKDEP, timeref_t t_ahead=AHEAD,
 	   timeref_t t_chi2=TCHI2);
-  void reset(timeref_t t_start);
-  void setrail(raw_t r1, raw_t r2) { rail1=r1; rail2=r2; }
-  void setusenegv(bool);
-  timeref_t process(timeref_t t_limit);
-  timeref_t forcepeg(timeref_t t_from, timeref_t t_to);
-private:
-  void init_T();
-  void calc_X012(); // at t0
-  void calc_X3(); // at t0
-  void update_X0123(); // for t0, from t0-1
-  inline void update_X012(); // for t_stream, from t_stream-1 (!)
-  void calc_alpha0123(); // from X0123
-  inline void calc_alpha0(); // from X02
-  State statemachine(timeref_t t_limit, State s);
-  inline bool ispegged(raw_t value) { return value<=rail1 || value>=rail2; }
-private:
-  // external world communication
-  CyclBuf<raw_t> const &source;
-  CyclBuf<raw_t> &dest;
-private:
-  // externally imposed constants
-  raw_t y_threshold;
-  int tau;
-  int t_blankdepeg;
-  int t_ahead;
-  int t_chi2;
-  raw_t rail1, rail2;
-  bool usenegv;
-private:
-  // self computed constants
-  int_t tau_plus_1;
-  int_t tau_plus_1_squared;
-  int_t tau_plus_1_cubed;
-  int_t minus_tau;
-  int_t minus_tau_squared;
-  int_t minus_tau_cubed;
-  int_t T0, T2, T4, T6;
-  real_t my_thresh;
+  void reset(timeref_t t_start) { bank.reset(t_start); }
+  void setrail(raw_t r1, raw_t r2) { bank.setrail(0, r1, r2); }
+  void setusenegv(bool t) { bank.setusenegv(t); }
+  timeref_t process(timeref_t t_limit) { return bank.process(t_limit); }
+  timeref_t forcepeg(timeref_t t_from, timeref_t t_to) {
+    return bank.forcepeg(t_from, t_to);
+  }
 private:
-  // state variables
-  State state;
-  timeref_t t_stream, t0;
-  int_t X0, X1, X2, X3;
-  real_t alpha0, alpha1, alpha2, alpha3;
-  int toopoorcnt;
-  bool negv;
-  // timeref_t t_peg;
+  LocalFitBank bank;
 public:
   // debug
-  void report();
-  void condreport();
-  void inirep();
-  char const *stateName(State s);
-  void crash(char const *);
-  int debug_name;
+  void report() { bank.report(0); }
+  void inirep() { bank.inirep(); }
 };
 
 #endif
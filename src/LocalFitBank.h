@@ -0,0 +1,1472 @@
+// LocalFitBank.h
+
+#ifndef LOCALFITBANK_H
+
+#define LOCALFITBANK_H
+
+/* A LocalFitBank runs the SALPA state machine for a whole set of
+   channels that share a single (typically interleaved) buffer. State
+   is kept in one contiguous array per variable rather than in one
+   object per channel, so that the per-chunk cost of processing a
+   range of channels does not involve chasing pointers through the
+   heap.
+
+   Channel c of the bank lives at offset c*chanstride from the first
+   channel in SOURCE and DEST. For the usual interleaved layout, the
+   buffers have a stride equal to the total number of channels in a
+   scan, and chanstride is 1.
+
+   This is the only implementation of the algorithm: the command line
+   program, the Python module, and the Matlab mex file all use it. It
+   is a template on the sample type and on the buffer type (CyclBuf for
+   streaming, LinBuf for plain arrays), so it all lives in this header.
+   For integer samples, the sums are exact integers. For floating point
+   samples, they are doubles, and blanked samples are NaN rather than
+   zero.
+
+   See LocalFit.h for the numerical caveats; they apply here as well.
+*/
+
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <type_traits>
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include "CyclBuf.h"
+#include "Trace.h"
+
+typedef std::int16_t raw_t;
+typedef std::uint64_t timeref_t;
+constexpr timeref_t INFTY = ~0;
+
+template <typename Sample, bool integral=std::is_integral<Sample>::value>
+struct SampleTraits {
+  // integer samples
+  typedef std::int64_t sum_t;
+  static constexpr bool exact = true; // sums are free of rounding error
+  static Sample blank() { return 0; }
+  static double range() { return -double(std::numeric_limits<Sample>::min()); }
+};
+
+template <typename Sample> struct SampleTraits<Sample, false> {
+  // floating point samples
+  typedef double sum_t;
+  static constexpr bool exact = false;
+  static Sample blank() { return std::numeric_limits<Sample>::quiet_NaN(); }
+  static double range() { return 0; }
+};
+
+template <int Tau> struct FixedTau {
+  // tau known at compile time, so that loops over the window unroll
+  FixedTau(int) { }
+  operator int() const { return Tau; }
+};
+
+template <> struct FixedTau<0> {
+  // tau known only at run time
+  FixedTau(int tau): tau(tau) { }
+  operator int() const { return tau; }
+  int tau;
+};
+
+template <typename Sample, typename Buffer=CyclBuf<Sample>>
+class BasicLocalFitBank {
+public:
+  typedef double real_t;
+  typedef std::int64_t int_t;
+  typedef typename SampleTraits<Sample>::sum_t sum_t;
+#if defined(__SIZEOF_INT128__)
+  __extension__ typedef __int128 wide_t; // for products that may not fit int_t
+  static constexpr int wide_bits = 128;
+#else
+  typedef std::int64_t wide_t; // e.g., MSVC has no 128-bit integers
+  static constexpr int wide_bits = 64;
+#endif
+public:
+  enum class State {
+    OK,
+    PEGGING,
+    PEGGED,
+    TOOPOOR,
+    DEPEGGING,
+    FORCEPEG,
+    BLANKDEPEG,
+    DEAD
+  };
+  static constexpr int NSTATES = 8;
+  /* State variables kept in each state:
+
+    	 var\state OK PEGGING PEGGED TOOPOOR DEPEGGING FORCEPEG BLANKDEPEG DEAD
+    		   -- ------- ------ ------- --------- -------- ---------- ----
+    	 t_stream   y    y      y      y        y         y         y       y
+    	 t_0        *    y      *      y        y         +         y       n
+    	 X_0..2     y    y      n      y        y         n         y       n
+    	 X_3        n    y      n      y        y         n         y       n
+    	 alpha_0..3 n    y      n      y        y         n         y       n
+         toopoorcnt n    n      n      y        n         n         n       n
+
+     *: t_0 is implicitly equal to t_stream and not kept
+     +: t_0 is used to mark end of forced peg
+
+     State DEAD is only entered and left through SETDEAD. A dead channel
+     is not fitted at all; its output is zero.
+  */
+  static constexpr raw_t RAIL1=-30000;
+  static constexpr raw_t RAIL2=30000;
+  static constexpr timeref_t TCHI2=15; // samples
+  static constexpr timeref_t BLANKDEP=5; // samples
+  static constexpr timeref_t AHEAD=5; // samples
+  static constexpr timeref_t TOOPOORCNT=5;
+#if defined(__AVX512F__)
+  static constexpr int LANES = 32; // channels run in lockstep in state OK
+#elif defined(__AVX2__)
+  static constexpr int LANES = 16;
+#else
+  static constexpr int LANES = 8;
+#endif
+  static constexpr int MINLANES = LANES/4;
+  static constexpr int OKBLOCK = 64; // samples per block in state OK
+  static constexpr int SCANBLOCK = 256; // samples per block in rail scan
+  static constexpr int SEGBLOCK = 64; // samples per block in fitted states
+  static constexpr int MAXORDER = 3; // cubic fit
+public:
+  BasicLocalFitBank(Buffer const &source, Buffer &dest,
+                    int nchans, int chanstride,
+                    timeref_t t_start, timeref_t tau,
+                    timeref_t t_blankdepeg=BLANKDEP, timeref_t t_ahead=AHEAD,
+                    timeref_t t_chi2=TCHI2);
+  int channels() const { return nchans; }
+  void reset(timeref_t t_start);
+  void setthreshold(int c, real_t threshold);
+  void setrail(int c, real_t r1, real_t r2);
+  /* SETRAIL sets the rails of channel C: samples at or beyond either
+     rail are pegged. A rail that lies outside the range of Sample
+     (e.g., +/-inf) can never be reached, so that side never pegs.
+  */
+  void setusenegv(bool);
+  void setorder(int order);
+  void setdead(int c, bool dead);
+  bool dead(int c) const { return state[c]==State::DEAD; }
+  State stateof(int c) const { return state[c]; }
+  /* SETDEAD takes channel C out of the state machine, or puts it back
+     in. A channel that comes back is in state OK, as if it had been
+     all along, unless the rails are hit within the look-ahead of state
+     OK, in which case it is PEGGED. (That is decided, and the sums of
+     state OK recalculated, at the next PROCESS or FORCEPEG, when the
+     data are there.) It must not be called while PROCESS or FORCEPEG
+     is running on C.
+  */
+  /* SETORDER selects the order of the fitted polynomial: 0 (constant)
+     up to MAXORDER (cubic, the default). Each order, combined with
+     each of the common values of tau (45, 60, 75, 90), has its own
+     compiled kernel, so that lower orders do not pay for terms they
+     do not use.
+  */
+  char const *accumulator() const; // widths chosen for this tau
+  timeref_t process(timeref_t t_limit, int c0=0, int c1=-1);
+  timeref_t forcepeg(timeref_t t_from, timeref_t t_to, int c0=0, int c1=-1);
+  struct Stats {
+    timeref_t samples[NSTATES]; // samples spent in each state
+    timeref_t pegs; // rail crossings detected in state OK
+    timeref_t forcepegs; // calls to forcepeg
+    timeref_t retries; // restarts of the countdown in state TOOPOOR
+    timeref_t blanked; // samples replaced by blanks
+    real_t sumsq_in, sumsq_out; // sums of squares over samples in state OK
+  };
+  Stats const &stats(int c) const { return qc[c]; }
+  /* PROCESS and FORCEPEG operate on channels C0 up to (but not
+     including) C1; C1=-1 means: all channels. Different threads may
+     work on disjoint channel ranges simultaneously. The return value
+     is the time up to which all those channels have been processed,
+     which should equal T_LIMIT (resp. T_TO) unless something is badly
+     wrong.
+     The source must be valid up to T_LIMIT (resp. T_FROM) plus
+     max(2*tau, tau+t_ahead, t_chi2) at the time of the call, and must not
+     change after that: rail crossings are scanned for once and
+     remembered. With a bounded buffer (LinBuf), everything from its
+     end on counts as pegged.
+     STATS returns quality control counters for channel C, accumulated
+     since construction. They cost next to nothing, and save a second
+     pass over the data to find out whether a run went sensibly.
+  */
+private:
+  template <int Order, int Tau> class Fitter;
+  struct Run {
+    timeref_t start, end; // pegged samples; end is INFTY while still open
+  };
+  void init_T();
+  void choosekernel();
+  template <int Order> void choosekernel();
+  template <int Order, int Tau>
+  timeref_t processwith(timeref_t t_limit, int c0, int c1);
+  template <int Order, int Tau>
+  timeref_t forcepegwith(timeref_t t_from, timeref_t t_to, int c0, int c1);
+  template <int Order, int Tau> void revive(int c);
+  template <typename Sum, typename Prod, bool Quad>
+  void lockstep(int cl, timeref_t t_limit);
+  void tallylane(int c, timeref_t n, sum_t ssin, sum_t ssout) {
+    qc[c].samples[int(State::OK)] += n;
+    qc[c].sumsq_in += ssin;
+    qc[c].sumsq_out += ssout;
+  }
+  void prescan(timeref_t t_to, int c0, int c1);
+  void prescanrows(timeref_t t_to, int cl, int nl);
+  void prescancolumn(int c, timeref_t t_to);
+  void pegedge(int c, timeref_t t, bool pegged);
+  Run const *findrun(int c, timeref_t t) const;
+  timeref_t nextpeg(int c, timeref_t t) const;
+  void prunepegs(int c, timeref_t t);
+private:
+  // external world communication
+  std::vector<Buffer> sources;
+  std::vector<Buffer> dests;
+private:
+  // externally imposed constants
+  int nchans;
+  int chanstride;
+  int tau;
+  int t_blankdepeg;
+  int t_ahead;
+  int t_chi2;
+  int order;
+  bool usenegv;
+  std::vector<Sample> rail1, rail2;
+  std::vector<char> armed1, armed2; // rail within range of Sample
+  std::vector<real_t> my_thresh;
+private:
+  // self computed constants
+  int_t tau_plus_1;
+  int_t tau_plus_1_squared;
+  int_t tau_plus_1_cubed;
+  int_t minus_tau;
+  int_t minus_tau_squared;
+  int_t minus_tau_cubed;
+  int_t T0, T2, T4, T6;
+  real_t B0, B1, B2, B3; // sums of powers of t over the asym window
+  bool narrow; // sums in lockstep fit in 32 bits
+  bool okwide; // products in state OK may not fit in int_t
+  bool fitwide; // products in the cubic fit may not fit in int_t
+  timeref_t (BasicLocalFitBank::*processfn)(timeref_t, int, int);
+  timeref_t (BasicLocalFitBank::*forcepegfn)(timeref_t, timeref_t, int, int);
+private:
+  // state variables, one entry per channel
+  std::vector<State> state;
+  std::vector<timeref_t> t_stream, t0;
+  std::vector<sum_t> X0, X1, X2, X3;
+  std::vector<real_t> alpha0, alpha1, alpha2, alpha3;
+  std::vector<int> toopoorcnt;
+  std::vector<char> negv;
+  std::vector<char> reviving; // back from DEAD; see SETDEAD
+  std::vector<Stats> qc;
+private:
+  // rail crossings, one list of runs per channel
+  std::vector<std::vector<Run>> pegruns;
+  std::vector<std::size_t> peghead; // runs before this are history
+  std::vector<timeref_t> scanned; // end of the scanned stretch
+  int lookahead; // how far past t_stream the state machine may look
+public:
+  // debug
+  void report(int c);
+  void inirep();
+  static char const *stateName(State s);
+  static void crash(char const *);
+};
+
+typedef BasicLocalFitBank<raw_t> LocalFitBank;
+
+//--------------------------------------------------------------------
+// Fitter: working copy of the state of a single channel
+//
+/* The state machine proper runs on a Fitter, which holds the state of
+   one channel in local variables for the duration of a call to
+   process() or forcepeg(), and writes it back to the bank's arrays
+   afterwards.
+   ORDER is the order of the polynomial. Orders below 2 do not keep X1
+   and X2 in state OK: the fit there only needs X0. TAU is the
+   half-width of the window if known at compile time, or zero.
+*/
+
+template <typename Sample, typename Buffer>
+template <int Order, int Tau>
+class BasicLocalFitBank<Sample, Buffer>::Fitter {
+public:
+  Fitter(BasicLocalFitBank &bank, int c):
+    bank(bank), c(c),
+    source(bank.sources[c]), dest(bank.dests[c]),
+    qc(bank.qc[c]), here(bank.state[c]), t_mark(bank.t_stream[c]),
+    tau(bank.tau), t_blankdepeg(bank.t_blankdepeg),
+    t_ahead(bank.t_ahead), t_chi2(bank.t_chi2),
+    usenegv(bank.usenegv),
+    T0(bank.T0), T2(bank.T2), T4(bank.T4), T6(bank.T6),
+    B0(bank.B0), B1(bank.B1), B2(bank.B2), B3(bank.B3),
+    my_thresh(bank.my_thresh[c]),
+    okwide(bank.okwide), fitwide(bank.fitwide),
+    blank(SampleTraits<Sample>::blank()),
+    t_stream(bank.t_stream[c]), t0(bank.t0[c]),
+    X0(bank.X0[c]), X1(bank.X1[c]), X2(bank.X2[c]), X3(bank.X3[c]),
+    alpha0(bank.alpha0[c]), alpha1(bank.alpha1[c]),
+    alpha2(bank.alpha2[c]), alpha3(bank.alpha3[c]),
+    toopoorcnt(bank.toopoorcnt[c]),
+    negv(bank.negv[c]),
+    Ychi2(0) {
+  }
+  void store() {
+    tally(here);
+    bank.t_stream[c] = t_stream;
+    bank.t0[c] = t0;
+    bank.X0[c] = X0;
+    bank.X1[c] = X1;
+    bank.X2[c] = X2;
+    bank.X3[c] = X3;
+    bank.alpha0[c] = alpha0;
+    bank.alpha1[c] = alpha1;
+    bank.alpha2[c] = alpha2;
+    bank.alpha3[c] = alpha3;
+    bank.toopoorcnt[c] = toopoorcnt;
+    bank.negv[c] = negv;
+    bank.prunepegs(c, t_stream);
+  }
+  State process(timeref_t t_limit, State s) {
+    return statemachine(t_limit, s);
+  }
+  State forcepeg(timeref_t t_from, timeref_t t_to, State s) {
+    if (s==State::DEAD)
+      return statemachine(t_to, s);
+    note(TraceKind::FORCEPEG, t_from, real_t(t_to - t_from));
+    qc.forcepegs++;
+    s = statemachine(t_from > timeref_t(tau) ? t_from - tau : 0, s);
+    if (s==State::OK) {
+      // goto state PEGGING
+        t0 = t_stream - 1;
+        if (Order==1)
+          calc_X012(); // state OK does not keep X1
+        calc_X3();
+        calc_alpha0123();
+        s = statemachine(t_from, State::PEGGING);
+    }
+    t0 = t_to;
+    return statemachine(t_to, State::FORCEPEG);
+  }
+  void resume() { // into OK at t_stream, from scratch
+    t0 = t_stream;
+    calc_X012();
+  }
+  State startpegging() { // from OK
+    note(TraceKind::PEG, t_stream, source[t_stream+tau+t_ahead]);
+    qc.pegs++;
+    t0 = t_stream-1;
+    if (Order==1)
+      calc_X012(); // state OK does not keep X1
+    calc_X3();
+    calc_alpha0123();
+    return State::PEGGING;
+  }
+private:
+  template <typename Prod> bool okblock(timeref_t t_limit);
+  void sumsquares(Sample const *in, Sample const *out, int n) {
+    sum_t ssin = 0, ssout = 0;
+    for (int m=0; m<n; m++) {
+      ssin += sum_t(in[m])*in[m];
+      ssout += sum_t(out[m])*out[m];
+    }
+    qc.sumsq_in += ssin;
+    qc.sumsq_out += ssout;
+  }
+  void calc_X012(); // at t0, as far as Order needs
+  void calc_X3(); // at t0, if Order needs it
+  void update_X0123(); // for t0, from t0-1
+  real_t fit(int dt) const { // the polynomial at t0+dt
+    real_t y = alpha0;
+    if (Order>=1)
+      y += alpha1*dt;
+    if (Order>=2)
+      y += alpha2*(dt*dt);
+    if (Order>=3)
+      y += alpha3*(dt*dt*dt);
+    return y;
+  }
+  int residuals(Sample *y, timeref_t t_end) const {
+    /* Fills Y with the residuals from the fit for up to SEGBLOCK
+       samples from t_stream on, but not beyond T_END. Returns the
+       number of samples. Each sample is evaluated exactly as fit()
+       would do it, but without a loop-carried dependency, so the
+       compiler can vectorize this.
+    */
+    int n = SEGBLOCK;
+    if (t_end - t_stream < timeref_t(n))
+      n = t_end - t_stream;
+    source.read(y, t_stream, n);
+    int dt0 = t_stream - t0;
+    for (int m=0; m<n; m++)
+      y[m] -= fit(dt0 + m);
+    return n;
+  }
+  void subtractfit(timeref_t t_end) {
+    // Writes the residuals from t_stream up to T_END to DEST.
+    while (t_stream < t_end) {
+      Sample y[SEGBLOCK];
+      int n = residuals(y, t_end);
+      dest.write(t_stream, y, n);
+      t_stream += n;
+    }
+  }
+  void calc_alpha0123() { // from X0123
+    if (fitwide)
+      calc_alpha0123<wide_t>();
+    else
+      calc_alpha0123<int_t>();
+  }
+  template <typename Prod> void calc_alpha0123();
+  void calc_Ychi2(); // at t_stream
+  State statemachine(timeref_t t_limit, State s);
+  timeref_t nextpeg(timeref_t t) const { return bank.nextpeg(c, t); }
+  timeref_t pegend(timeref_t t) const { return bank.findrun(c, t)->end; }
+  void tally(State s) {
+    // Charges the samples since the previous call to the state we were in.
+    qc.samples[int(here)] += t_stream - t_mark;
+    t_mark = t_stream;
+    here = s;
+  }
+  void note(TraceKind kind, timeref_t t, real_t value=0) const {
+    Trace::record(kind, c, t, value); // nothing unless SALPA_TRACE
+  }
+private:
+  BasicLocalFitBank &bank;
+  int c;
+  // external world communication
+  Buffer const &source;
+  Buffer &dest;
+  Stats &qc;
+  State here; // for the time spent in each state
+  timeref_t t_mark;
+  // constants
+  FixedTau<Tau> tau;
+  int t_blankdepeg;
+  int t_ahead;
+  int t_chi2;
+  bool usenegv;
+  int_t T0, T2, T4, T6;
+  real_t B0, B1, B2, B3;
+  real_t my_thresh;
+  bool okwide, fitwide;
+  Sample blank; // what pegged samples are replaced with
+public:
+  // state variables
+  timeref_t t_stream, t0;
+  sum_t X0, X1, X2, X3;
+  real_t alpha0, alpha1, alpha2, alpha3;
+  int toopoorcnt;
+  bool negv;
+  sum_t Ychi2; // sum of the t_chi2 samples from t_stream on, in TOOPOOR
+};
+
+template <typename Sample, typename Buffer>
+template <int Order, int Tau>
+auto BasicLocalFitBank<Sample, Buffer>::Fitter<Order, Tau>::statemachine(
+                                         timeref_t t_limit, State s) -> State {
+
+  /* This is a straightforward implementation of the statemachine I
+     described on 9/9/01.
+   * //// mark boundaries program flow does not pass through.
+   * On exit, t_stream == t_limit.
+  */
+  switch (s) {
+  case State::OK: goto l_OK;
+  case State::PEGGED: goto l_PEGGED;
+  case State::PEGGING: goto l_PEGGING;
+  case State::TOOPOOR: calc_Ychi2(); goto l_TOOPOOR;
+  case State::DEPEGGING: goto l_DEPEGGING;
+  case State::FORCEPEG: goto l_FORCEPEG;
+  case State::BLANKDEPEG: goto l_BLANKDEPEG;
+  case State::DEAD: goto l_DEAD;
+  default: crash("Bad State");
+  }
+
+//////////////////////////////////////////////////
+ l_DEAD: {
+    tally(State::DEAD);
+    if (t_stream<t_limit) {
+      dest.fill(t_stream, Sample(0), t_limit - t_stream);
+      t_stream = t_limit;
+    }
+    return State::DEAD;
+  }
+
+//////////////////////////////////////////////////
+ l_PEGGED: {
+    tally(State::PEGGED);
+    if (t_stream>=t_limit)
+      return State::PEGGED;
+    if (nextpeg(t_stream)==t_stream) {
+      timeref_t t_end = pegend(t_stream);
+      if (t_end > t_limit)
+        t_end = t_limit;
+      dest.fill(t_stream, blank, t_end - t_stream);
+      qc.blanked += t_end - t_stream;
+      t_stream = t_end;
+      goto l_PEGGED;
+    }
+    timeref_t t_peg = nextpeg(t_stream+1);
+    if (t_peg <= t_stream+2*tau) {
+      note(TraceKind::REPEG, t_stream);
+      t0 = t_peg;
+      goto l_FORCEPEG;
+    }
+    t0 = t_stream + tau;
+    calc_X012(); calc_X3();
+    calc_alpha0123();
+    calc_Ychi2();
+    toopoorcnt=TOOPOORCNT;
+    if (Trace::enabled) {
+      real_t asym = alpha0*B0 + alpha1*B1 + alpha2*B2 + alpha3*B3 - Ychi2;
+      note(TraceKind::TOOPOOR, t_stream, asym*asym/my_thresh);
+    }
+    goto l_TOOPOOR;
+  }
+  crash("Code breach");
+
+//////////////////////////////////////////////////
+ l_TOOPOOR: {
+    tally(State::TOOPOOR);
+    if (t_stream>=t_limit)
+      return State::TOOPOOR;
+
+    /* In this state, t_stream is always t0-tau, so the fit is
+       evaluated at the same offsets for every sample, and the sum
+       of the residuals over the window follows from the basis sums
+       B0..B3 and the running sum of the data.
+    */
+    real_t asym = alpha0*B0 + alpha1*B1 + alpha2*B2 + alpha3*B3 - Ychi2;
+    asym *= asym;
+    if (asym<my_thresh) {
+      toopoorcnt--;
+    } else {
+      if (toopoorcnt<int(TOOPOORCNT)) {
+        note(TraceKind::RETRY, t_stream, asym/my_thresh);
+        qc.retries++;
+      }
+      toopoorcnt = TOOPOORCNT;
+    }
+    if (toopoorcnt<=0 && asym < my_thresh/3.92) {
+      note(TraceKind::DEPEG, t_stream, asym/my_thresh);
+      if (usenegv)
+        negv = source[t_stream] < Sample(fit(t_stream - t0));
+      goto l_BLANKDEPEG;
+    }
+
+    dest[t_stream] = blank;
+    qc.blanked++;
+    Ychi2 += sum_t(source[t_stream+t_chi2]) - sum_t(source[t_stream]);
+    t_stream++; t0++;
+    if (nextpeg(t0+tau)==t0+tau) {
+      note(TraceKind::REPEG, t_stream);
+      t0=t0+tau;
+      goto l_FORCEPEG;
+    }
+    if (SampleTraits<Sample>::exact) {
+      update_X0123(); // exact, so no need to recompute from scratch
+    } else {
+      // rounding errors would accumulate in the running sums
+      calc_X012(); calc_X3();
+      calc_Ychi2();
+    }
+    calc_alpha0123();
+    goto l_TOOPOOR;
+  }
+  crash("Code breach");
+
+//////////////////////////////////////////////////
+ l_FORCEPEG: {
+    tally(State::FORCEPEG);
+    if (t_stream>=t_limit)
+      return State::FORCEPEG;
+    if (t_stream>=t0)
+      goto l_PEGGED;
+    timeref_t t_end = t0 < t_limit ? t0 : t_limit;
+    dest.fill(t_stream, blank, t_end - t_stream);
+    qc.blanked += t_end - t_stream;
+    t_stream = t_end;
+    goto l_FORCEPEG;
+  }
+  crash("Code breach");
+
+//////////////////////////////////////////////////
+ l_BLANKDEPEG: {
+    tally(State::BLANKDEPEG);
+    if (t_stream>=t_limit)
+      return State::BLANKDEPEG;
+    if (t_stream >= t0-tau+t_blankdepeg)
+      goto l_DEPEGGING;
+    timeref_t t_end = t0-tau+t_blankdepeg;
+    if (t_end > t_limit)
+      t_end = t_limit;
+    if (usenegv) {
+      // blank until the residual changes sign
+      Sample y[SEGBLOCK];
+      int n = residuals(y, t_end);
+      int m = 0;
+      while (m<n && (y[m]<0) == negv)
+        m++;
+      dest.fill(t_stream, blank, m);
+      qc.blanked += m;
+      t_stream += m;
+      if (m<n) {
+        dest[t_stream] = y[m];
+        t_stream++;
+        goto l_DEPEGGING;
+      }
+    } else {
+      dest.fill(t_stream, blank, t_end - t_stream);
+      qc.blanked += t_end - t_stream;
+      t_stream = t_end;
+    }
+    goto l_BLANKDEPEG;
+  }
+  crash("Code breach");
+
+//////////////////////////////////////////////////
+ l_DEPEGGING: {
+    tally(State::DEPEGGING);
+    if (t_stream>=t_limit)
+      return State::DEPEGGING;
+    if (t_stream==t0) {
+      note(TraceKind::RESUME, t_stream);
+      goto l_OK;
+    }
+    timeref_t t_end = t0 > t_stream && t0 < t_limit ? t0 : t_limit;
+    subtractfit(t_end);
+    goto l_DEPEGGING;
+  }
+  crash("Code breach");
+
+//////////////////////////////////////////////////
+ l_PEGGING: {
+    tally(State::PEGGING);
+    if (t_stream >= t_limit)
+      return State::PEGGING;
+    if (t_stream >= t0 + tau) {
+      goto l_PEGGED;
+    }
+    timeref_t t_end = t0 + tau < t_limit ? t0 + tau : t_limit;
+    subtractfit(t_end);
+    goto l_PEGGING;
+  }
+  crash("Code breach");
+
+//////////////////////////////////////////////////
+ l_OK: {
+    tally(State::OK);
+    if (t_stream>=t_limit)
+      return State::OK;
+    if (okwide ? okblock<wide_t>(t_limit) : okblock<int_t>(t_limit)) {
+      startpegging();
+      goto l_PEGGING;
+    }
+    goto l_OK;
+  }
+
+  crash("Code breach");
+
+//////////////////////////////////////////////////
+}
+
+template <typename Sample, typename Buffer>
+template <int Order, int Tau>
+template <typename Prod>
+bool BasicLocalFitBank<Sample, Buffer>::Fitter<Order, Tau>::okblock(timeref_t t_limit) {
+  /* Runs state OK for up to OKBLOCK samples, i.e., until T_LIMIT or
+     until a peg is detected. Returns true in the latter case, with
+     t_stream pointing just past the last sample processed and X0..2
+     corresponding to the sample before that, exactly as the
+     one-sample-at-a-time implementation would leave it.
+     Rather than updating X0..2 through their mutual recurrence, we
+     keep running sums W_p = sum_j j^p y_j over the window, where j
+     counts from the start of the block. These are independent prefix
+     sums, and X_k follows from them by binomial expansion. For integer
+     samples, everything is exact integer arithmetic, so results are
+     bit-identical to the recurrence. The expensive part, calculating
+     alpha0 and subtracting, no longer has a loop-carried dependency
+     at all.
+  */
+  int n = OKBLOCK;
+  if (t_limit - t_stream < timeref_t(n))
+    n = t_limit - t_stream;
+  timeref_t t_peek = t_stream+1+tau+t_ahead;
+  timeref_t t_peg = nextpeg(t_peek);
+  bool pegged = false;
+  if (t_peg < t_peek + n) {
+    n = t_peg - t_peek + 1;
+    pegged = true;
+  }
+
+  Sample y_now[OKBLOCK], y_new[OKBLOCK], y_old[OKBLOCK];
+  source.read(y_now, t_stream, n);
+  source.read(y_new, t_stream+1+tau, n);
+  source.read(y_old, t_stream-tau, n);
+  Sample out[OKBLOCK] = {}; // zeroed only to quiet -Wmaybe-uninitialized
+
+  if (Order<2) {
+    // The fit is just the mean, so only X0 matters.
+    sum_t W0[OKBLOCK+1];
+    W0[0] = X0;
+    for (int m=0; m<n; m++)
+      W0[m+1] = W0[m] + (sum_t(y_new[m]) - sum_t(y_old[m]));
+    for (int m=0; m<n; m++) {
+      Sample y = y_now[m];
+      y -= real_t(W0[m]) / real_t(T0);
+      out[m] = y;
+    }
+    dest.write(t_stream, out, n);
+    sumsquares(y_now, out, n);
+    X0 = W0[pegged ? n - 1 : n];
+    t_stream += n;
+    return pegged;
+  }
+
+  sum_t e0[OKBLOCK], e1[OKBLOCK], e2[OKBLOCK];
+  for (int m=0; m<n; m++) {
+    int_t j_new = m + 1 + tau;
+    int_t j_old = m - tau;
+    sum_t yn = y_new[m];
+    sum_t yo = y_old[m];
+    e0[m] = yn - yo;
+    e1[m] = j_new*yn - j_old*yo;
+    e2[m] = j_new*j_new*yn - j_old*j_old*yo;
+  }
+
+  sum_t W0[OKBLOCK+1], W1[OKBLOCK+1], W2[OKBLOCK+1];
+  W0[0] = X0;
+  W1[0] = X1;
+  W2[0] = X2;
+  for (int m=0; m<n; m++) {
+    W0[m+1] = W0[m] + e0[m];
+    W1[m+1] = W1[m] + e1[m];
+    W2[m+1] = W2[m] + e2[m];
+  }
+
+  real_t denom = real_t(Prod(T0)*T4 - Prod(T2)*T2);
+  for (int m=0; m<n; m++) {
+    sum_t x0 = W0[m];
+    sum_t x2 = W2[m] - 2*m*W1[m] + m*m*W0[m];
+    Sample y = y_now[m];
+    y -= real_t(Prod(T4)*x0 - Prod(T2)*x2) / denom;
+    out[m] = y;
+  }
+  dest.write(t_stream, out, n);
+  sumsquares(y_now, out, n);
+
+  int_t m = pegged ? n - 1 : n;
+  X0 = W0[m];
+  X1 = W1[m] - m*W0[m];
+  X2 = W2[m] - 2*m*W1[m] + m*m*W0[m];
+  t_stream += n;
+  return pegged;
+}
+
+template <typename Sample, typename Buffer>
+template <int Order, int Tau>
+void BasicLocalFitBank<Sample, Buffer>::Fitter<Order, Tau>::calc_X012() {
+  X0 = X1 = X2 = 0;
+  for (int t=-tau; t<=tau; t++) {
+    int_t t2 = t*t;
+    sum_t y = source[t0+t];
+    X0 += y;
+    if (Order>=1)
+      X1 += t*y;
+    if (Order>=2)
+      X2 += t2*y;
+  }
+}
+
+template <typename Sample, typename Buffer>
+template <int Order, int Tau>
+void BasicLocalFitBank<Sample, Buffer>::Fitter<Order, Tau>::calc_X3() {
+  X3 = 0;
+  if (Order<3)
+    return;
+  for (int t=-tau; t<=tau; t++) {
+    int_t t3 = t*t*t;
+    sum_t y = source[t0+t];
+    X3 += t3*y;
+  }
+}
+
+template <typename Sample, typename Buffer>
+template <int Order, int Tau>
+void BasicLocalFitBank<Sample, Buffer>::Fitter<Order, Tau>::calc_Ychi2() {
+  Ychi2 = 0;
+  for (int i=0; i<t_chi2; i++)
+    Ychi2 += source[t_stream+i];
+}
+
+template <typename Sample, typename Buffer>
+template <int Order, int Tau>
+void BasicLocalFitBank<Sample, Buffer>::Fitter<Order, Tau>::update_X0123() {
+  /* The sums are integers and so is every step of the recurrence, so
+     the result is exactly what calc_X012 and calc_X3 would give,
+     however long we keep this up. (Intermediate values stay well
+     within 64 bits; it is only the products in calc_alpha0123 that
+     are at risk, see LocalFit.h.)
+  */
+  int_t const tp1 = int_t(tau) + 1;
+  int_t const mt = -int_t(tau);
+  sum_t y_new = source[t0+tau];
+  sum_t y_old = source[t0-tau-1];
+  X0 += y_new - y_old;
+  if (Order>=1)
+    X1 += tp1*y_new - mt*y_old - X0;
+  if (Order>=2)
+    X2 += tp1*tp1*y_new - mt*mt*y_old - X0 - 2*X1;
+  if (Order>=3)
+    X3 += tp1*tp1*tp1*y_new - mt*mt*mt*y_old - X0 - 3*X1 - 3*X2;
+}
+
+template <typename Sample, typename Buffer>
+template <int Order, int Tau>
+template <typename Prod>
+void BasicLocalFitBank<Sample, Buffer>::Fitter<Order, Tau>::calc_alpha0123() {
+  /* The window is symmetric, so the even (alpha0, alpha2) and odd
+     (alpha1, alpha3) parts of the fit decouple, and dropping the top
+     term of either part leaves a plain average for the other.
+  */
+  alpha0 = alpha1 = alpha2 = alpha3 = 0;
+  if (Order>=2) {
+    real_t fact02 = 1./real_t(Prod(T0)*T4 - Prod(T2)*T2);
+    alpha0 = fact02*real_t(Prod(T4)*X0 - Prod(T2)*X2);
+    alpha2 = fact02*real_t(Prod(T0)*X2 - Prod(T2)*X0);
+  } else {
+    alpha0 = real_t(X0) / real_t(T0);
+  }
+  if (Order>=3) {
+    real_t fact13 = 1./real_t(Prod(T2)*T6 - Prod(T4)*T4);
+    alpha1 = fact13*real_t(Prod(T6)*X1 - Prod(T4)*X3);
+    alpha3 = fact13*real_t(Prod(T2)*X3 - Prod(T4)*X1);
+  } else if (Order>=1) {
+    alpha1 = real_t(X1) / real_t(T2);
+  }
+}
+
+//--------------------------------------------------------------------
+// LocalFitBank methods
+//
+template <typename Sample, typename Buffer>
+BasicLocalFitBank<Sample, Buffer>::BasicLocalFitBank(Buffer const &source,
+                                                     Buffer &dest,
+                                                     int nchans,
+                                                     int chanstride,
+                                                     timeref_t t_start,
+                                                     timeref_t tau0,
+                                                     timeref_t t_blankdepeg0,
+                                                     timeref_t t_ahead0,
+                                                     timeref_t t_chi20):
+  nchans(nchans),
+  chanstride(chanstride),
+  tau(tau0),
+  t_blankdepeg(t_blankdepeg0),
+  t_ahead(t_ahead0),
+  t_chi2(t_chi20),
+  order(MAXORDER),
+  rail1(nchans, Sample(RAIL1)), rail2(nchans, Sample(RAIL2)),
+  armed1(nchans, 1), armed2(nchans, 1),
+  my_thresh(nchans, 0),
+  state(nchans, State::PEGGED),
+  t_stream(nchans, t_start), t0(nchans, 0),
+  X0(nchans, 0), X1(nchans, 0), X2(nchans, 0), X3(nchans, 0),
+  alpha0(nchans, 0), alpha1(nchans, 0), alpha2(nchans, 0), alpha3(nchans, 0),
+  toopoorcnt(nchans, 0),
+  negv(nchans, 0),
+  reviving(nchans, 0),
+  qc(nchans, Stats()),
+  pegruns(nchans), peghead(nchans, 0), scanned(nchans, t_start) {
+  for (int c=0; c<nchans; c++) {
+    sources.push_back(source.view(c*chanstride));
+    dests.push_back(dest.view(c*chanstride));
+  }
+  usenegv = true;
+  lookahead = 2*tau > tau+t_ahead ? 2*tau : tau+t_ahead;
+  init_T();
+  choosekernel();
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::setusenegv(bool t) {
+  usenegv = t;
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::setdead(int c, bool d) {
+  if (d) {
+    state[c] = State::DEAD;
+    reviving[c] = 0;
+  } else if (state[c]==State::DEAD) {
+    state[c] = State::OK;
+    reviving[c] = 1;
+  }
+}
+
+template <typename Sample, typename Buffer>
+template <int Order, int Tau>
+void BasicLocalFitBank<Sample, Buffer>::revive(int c) {
+  // Completes SETDEAD(C, false), once the rails have been scanned for.
+  reviving[c] = 0;
+  if (nextpeg(c, t_stream[c]) <= t_stream[c] + tau + t_ahead) {
+    state[c] = State::PEGGED;
+  } else {
+    Fitter<Order, Tau> f(*this, c);
+    f.resume();
+    f.store();
+  }
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::setorder(int o) {
+  if (o<0 || o>MAXORDER)
+    crash("Bad polynomial order");
+  order = o;
+  choosekernel();
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::choosekernel() {
+  switch (order) {
+  case 0: choosekernel<0>(); break;
+  case 1: choosekernel<1>(); break;
+  case 2: choosekernel<2>(); break;
+  default: choosekernel<3>(); break;
+  }
+}
+
+template <typename Sample, typename Buffer>
+template <int Order>
+void BasicLocalFitBank<Sample, Buffer>::choosekernel() {
+  switch (tau) {
+  case 45:
+    processfn = &BasicLocalFitBank::processwith<Order, 45>;
+    forcepegfn = &BasicLocalFitBank::forcepegwith<Order, 45>;
+    break;
+  case 60:
+    processfn = &BasicLocalFitBank::processwith<Order, 60>;
+    forcepegfn = &BasicLocalFitBank::forcepegwith<Order, 60>;
+    break;
+  case 75:
+    processfn = &BasicLocalFitBank::processwith<Order, 75>;
+    forcepegfn = &BasicLocalFitBank::forcepegwith<Order, 75>;
+    break;
+  case 90:
+    processfn = &BasicLocalFitBank::processwith<Order, 90>;
+    forcepegfn = &BasicLocalFitBank::forcepegwith<Order, 90>;
+    break;
+  default:
+    processfn = &BasicLocalFitBank::processwith<Order, 0>;
+    forcepegfn = &BasicLocalFitBank::forcepegwith<Order, 0>;
+    break;
+  }
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::setthreshold(int c,
+                                                     real_t y_threshold) {
+  my_thresh[c] = 3.92 * t_chi2 * y_threshold*y_threshold; // 95% conf limit
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::setrail(int c, real_t r1, real_t r2) {
+  typedef std::numeric_limits<Sample> lim;
+  armed1[c] = r1 >= real_t(lim::lowest());
+  armed2[c] = r2 <= real_t(lim::max());
+  rail1[c] = armed1[c] ? Sample(r1) : lim::lowest();
+  rail2[c] = armed2[c] ? Sample(r2) : lim::max();
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::reset(timeref_t t_start) {
+  for (int c=0; c<nchans; c++) {
+    t_stream[c] = t_start;
+    state[c] = State::PEGGED;
+    reviving[c] = 0;
+    pegruns[c].clear();
+    peghead[c] = 0;
+    scanned[c] = t_start;
+  }
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::init_T() {
+  tau_plus_1 = tau+1;
+  tau_plus_1_squared = tau_plus_1 * tau_plus_1;
+  tau_plus_1_cubed = tau_plus_1_squared * tau_plus_1;
+  minus_tau = -tau;
+  minus_tau_squared = minus_tau * minus_tau;
+  minus_tau_cubed = minus_tau_squared * minus_tau;
+
+  T0=T2=T4=T6=0;
+  for (int t=-tau; t<=tau; t++) {
+    int_t t2=t*t;
+    int_t t4=t2*t2;
+    int_t t6=t4*t2;
+    T0+=1;
+    T2+=t2;
+    T4+=t4;
+    T6+=t6;
+  }
+
+  int_t b0=0, b1=0, b2=0, b3=0;
+  for (int t=-tau; t<t_chi2-tau; t++) {
+    b0+=1;
+    b1+=t;
+    b2+=t*t;
+    b3+=t*t*t;
+  }
+  B0=b0; B1=b1; B2=b2; B3=b3;
+
+  /* Choose accumulator widths that provably cannot overflow for any
+     data in the range of the sample type. The sums X_k are bounded by
+     YMAX times S_k = sum |t|^k, and the products in the fit by
+     combinations of those with the T_k. We do not take the rails into
+     account: samples beyond them can still enter the sums for a few
+     samples after a depeg. The factors 8 and 2 leave room for
+     intermediate results. Floating point sums are always doubles.
+     Only the lockstep kernel of state OK ever uses 32-bit sums (up to
+     a tau of about 23 samples). The sums kept per channel, and those
+     in the other states, are always sum_t, i.e., 64 bits for integer
+     samples.
+  */
+  narrow = okwide = fitwide = false;
+  if (!SampleTraits<Sample>::exact)
+    return;
+  real_t ymax = SampleTraits<Sample>::range();
+  real_t S0=0, S1=0, S2=0, S3=0;
+  for (int t=-tau; t<=tau; t++) {
+    real_t a = std::abs(t);
+    S0 += 1;
+    S1 += a;
+    S2 += a*a;
+    S3 += a*a*a;
+  }
+  real_t lim32 = std::ldexp(1., 31);
+  real_t lim64 = std::ldexp(1., 63);
+  narrow = 8*ymax*S2 < lim32;
+  okwide = 2*ymax*(real_t(T4)*S0 + real_t(T2)*S2) >= lim64
+    || real_t(T0)*T4 + real_t(T2)*T2 >= lim64;
+  fitwide = okwide
+    || 2*ymax*(real_t(T6)*S1 + real_t(T4)*S3) >= lim64
+    || 2*ymax*(real_t(T2)*S3 + real_t(T4)*S1) >= lim64
+    || real_t(T2)*T6 + real_t(T4)*T4 >= lim64;
+}
+
+template <typename Sample, typename Buffer>
+char const *BasicLocalFitBank<Sample, Buffer>::accumulator() const {
+  if (!SampleTraits<Sample>::exact)
+    return "double";
+  else if (fitwide)
+    return wide_bits>64 ? "int128" : "int64 (UNSAFE: no 128-bit integers)";
+  else if (narrow)
+    return "int32";
+  else
+    return "int64";
+}
+
+template <typename Sample, typename Buffer>
+timeref_t BasicLocalFitBank<Sample, Buffer>::process(timeref_t t_limit,
+                                                     int c0, int c1) {
+  if (c1<0)
+    c1 = nchans;
+  return (this->*processfn)(t_limit, c0, c1);
+}
+
+template <typename Sample, typename Buffer>
+timeref_t BasicLocalFitBank<Sample, Buffer>::forcepeg(timeref_t t_from,
+                                                      timeref_t t_to,
+                                                      int c0, int c1) {
+  if (c1<0)
+    c1 = nchans;
+  return (this->*forcepegfn)(t_from, t_to, c0, c1);
+}
+
+template <typename Sample, typename Buffer>
+template <int Order, int Tau>
+timeref_t BasicLocalFitBank<Sample, Buffer>::processwith(timeref_t t_limit,
+                                                         int c0, int c1) {
+  prescan(t_limit + lookahead + 1, c0, c1);
+  for (int c=c0; c<c1; c++)
+    if (reviving[c])
+      revive<Order, Tau>(c);
+  if (chanstride==1 && !Buffer::bounded) {
+    for (int cl=c0; cl+LANES<=c1; cl+=LANES) {
+      if (narrow)
+        lockstep<std::int32_t, int_t, (Order>=2)>(cl, t_limit);
+      else if (okwide)
+        lockstep<sum_t, wide_t, (Order>=2)>(cl, t_limit);
+      else
+        lockstep<sum_t, int_t, (Order>=2)>(cl, t_limit);
+    }
+  }
+  timeref_t t_reached = t_limit;
+  for (int c=c0; c<c1; c++) {
+    Fitter<Order, Tau> f(*this, c);
+    state[c] = f.process(t_limit, state[c]);
+    f.store();
+    if (t_stream[c] != t_limit)
+      t_reached = t_stream[c];
+  }
+  return t_reached;
+}
+
+template <typename Sample, typename Buffer>
+template <int Order, int Tau>
+timeref_t BasicLocalFitBank<Sample, Buffer>::forcepegwith(timeref_t t_from,
+                                                          timeref_t t_to,
+                                                          int c0, int c1) {
+  processwith<Order, Tau>(t_from > timeref_t(tau) ? t_from - tau : 0, c0, c1);
+  prescan(t_from + lookahead + 1, c0, c1);
+  timeref_t t_reached = t_to;
+  for (int c=c0; c<c1; c++) {
+    Fitter<Order, Tau> f(*this, c);
+    state[c] = f.forcepeg(t_from, t_to, state[c]);
+    f.store();
+    if (t_stream[c] != t_to)
+      t_reached = t_stream[c];
+  }
+  return t_reached;
+}
+
+template <typename Sample, typename Buffer>
+template <typename Sum, typename Prod, bool Quad>
+void BasicLocalFitBank<Sample, Buffer>::lockstep(int cl, timeref_t t_limit) {
+  /* Runs the OK state for channels CL up to CL+LANES in lockstep, so
+     that the compiler can map the channels onto SIMD lanes. This
+     requires the channels to be adjacent in memory (chanstride==1).
+     A channel that is not in state OK on entry, or that is about to
+     detect a peg, drops out and is left for the scalar state machine
+     to pick up. We give up on the whole group once fewer than
+     MINLANES channels remain.
+     Since no channel's state is stored back until it drops out or we
+     are done, the lanes that have dropped out can continue to be
+     computed (and written to DEST) without harm: the scalar state
+     machine subsequently overwrites those samples.
+     Where the pegs are is known from the rail scan, so the inner loop
+     runs uninterrupted up to the next one.
+     The running sums are kept in SUM, which may be narrower than
+     int_t if init_T has shown that to be safe; that way more lanes
+     fit in a vector register. Unless QUAD, the fit is a plain average
+     and only x0 is needed.
+  */
+  timeref_t t = t_stream[cl];
+  timeref_t const t_begin = t;
+  Sum x0[LANES], x1[LANES], x2[LANES];
+  sum_t ssin[LANES], ssout[LANES]; // for the QC counters
+  timeref_t t_peg[LANES]; // sample at which each lane detects a peg
+  char live[LANES];
+  int nlive = 0;
+  for (int l=0; l<LANES; l++) {
+    int c = cl + l;
+    if (t_stream[c] != t)
+      return;
+    live[l] = state[c]==State::OK;
+    nlive += live[l];
+    x0[l] = X0[c];
+    x1[l] = X1[c];
+    x2[l] = X2[c];
+    ssin[l] = ssout[l] = 0;
+    t_peg[l] = nextpeg(c, t+1+tau+t_ahead);
+    if (t_peg[l] != INFTY)
+      t_peg[l] -= 1+tau+t_ahead;
+  }
+
+  Sum const tp1 = tau_plus_1;
+  Sum const tp1sq = tau_plus_1_squared;
+  Sum const mt = minus_tau;
+  Sum const mtsq = minus_tau_squared;
+  real_t denom = Quad ? real_t(Prod(T0)*T4 - Prod(T2)*T2) : real_t(T0);
+  while (t<t_limit) {
+    for (int l=0; l<LANES; l++) {
+      if (live[l] && t_peg[l]<=t) {
+        int c = cl + l;
+        X0[c] = x0[l];
+        X1[c] = x1[l];
+        X2[c] = x2[l];
+        t_stream[c] = t;
+        tallylane(c, t - t_begin, ssin[l], ssout[l]);
+        live[l] = 0;
+        nlive--;
+      }
+    }
+    if (nlive < MINLANES)
+      break;
+    timeref_t t_stop = t_limit;
+    for (int l=0; l<LANES; l++)
+      if (live[l] && t_peg[l] < t_stop)
+        t_stop = t_peg[l];
+    Buffer const &src = sources[cl];
+    Buffer &dst = dests[cl];
+    int const sstep = src.step();
+    int const dstep = dst.step();
+    while (t<t_stop) {
+      // Rows are reached by stepping pointers, in pieces that do not
+      // cross the wrap point of the buffer (a mirrored one has none).
+      int n = t_stop - t < timeref_t(std::numeric_limits<int>::max())
+        ? int(t_stop - t) : std::numeric_limits<int>::max();
+      n = src.contiguous(t-tau, n);
+      n = src.contiguous(t, n);
+      n = src.contiguous(t+1+tau, n);
+      n = dst.contiguous(t, n);
+      Sample const *y_now = &src[t];
+      Sample const *y_new = &src[t+1+tau];
+      Sample const *y_old = &src[t-tau];
+      Sample *out = &dst[t];
+      for (int k=0; k<n; k++) {
+        for (int l=0; l<LANES; l++) {
+          Sample y = y_now[l];
+          if (Quad)
+            y -= real_t(Prod(T4)*x0[l] - Prod(T2)*x2[l]) / denom;
+          else
+            y -= real_t(x0[l]) / denom;
+          out[l] = y;
+          ssin[l] += sum_t(y_now[l])*y_now[l];
+          ssout[l] += sum_t(y)*y;
+        }
+        for (int l=0; l<LANES; l++) {
+          Sum yn = y_new[l];
+          Sum yo = y_old[l];
+          x0[l] += yn - yo;
+          if (Quad) {
+            x1[l] += tp1*yn - mt*yo - x0[l];
+            x2[l] += tp1sq*yn - mtsq*yo - x0[l] - 2*x1[l];
+          }
+        }
+        y_now += sstep;
+        y_new += sstep;
+        y_old += sstep;
+        out += dstep;
+      }
+      t += n;
+    }
+  }
+
+  for (int l=0; l<LANES; l++) {
+    if (live[l]) {
+      int c = cl + l;
+      X0[c] = x0[l];
+      X1[c] = x1[l];
+      X2[c] = x2[l];
+      t_stream[c] = t;
+      tallylane(c, t - t_begin, ssin[l], ssout[l]);
+    }
+  }
+}
+
+//--------------------------------------------------------------------
+// rail crossings
+//
+/* Rather than testing every sample that the state machine looks at
+   against the rails, we scan each stretch of new data once and record
+   the runs of pegged samples per channel. The state machine then jumps
+   straight to the next run, and blanks whole runs at once.
+   For the interleaved layout, a scan is a single pass over the rows of
+   the buffer that compares all channels at once; only rows where some
+   channel enters or leaves a run need any further attention.
+*/
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::prescan(timeref_t t_to,
+                                                int c0, int c1) {
+  // Extends the scan for channels C0 up to C1 to just before T_TO.
+  if (chanstride==1 && !Buffer::bounded) {
+    while (c1-c0 > 1) {
+      int nl = c1 - c0 < LANES ? c1 - c0 : LANES;
+      bool aligned = true;
+      for (int c=c0; c<c0+nl; c++)
+        if (scanned[c] != scanned[c0])
+          aligned = false;
+      if (!aligned)
+        break;
+      prescanrows(t_to, c0, nl);
+      c0 += nl;
+    }
+  }
+  for (int c=c0; c<c1; c++)
+    prescancolumn(c, t_to);
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::prescanrows(timeref_t t_to,
+                                                    int cl, int nl) {
+  // Scans channels CL up to CL+NL together; NL must not exceed LANES.
+  Sample r1[LANES], r2[LANES];
+  char a1[LANES], a2[LANES];
+  char open[LANES];
+  for (int l=0; l<nl; l++) {
+    int c = cl + l;
+    r1[l] = rail1[c];
+    r2[l] = rail2[c];
+    a1[l] = armed1[c];
+    a2[l] = armed2[c];
+    open[l] = !pegruns[c].empty() && pegruns[c].back().end==INFTY;
+  }
+  Buffer const &src = sources[cl];
+  int const sstep = src.step();
+  timeref_t t = scanned[cl];
+  while (t<t_to) {
+    int n = t_to - t < timeref_t(SCANBLOCK) ? int(t_to - t) : SCANBLOCK;
+    n = src.contiguous(t, n);
+    Sample const *y = &src[t];
+    for (int k=0; k<n; k++) {
+      char change = 0;
+      for (int l=0; l<nl; l++)
+        change |= (((y[l]<=r1[l]) & a1[l]) | ((y[l]>=r2[l]) & a2[l]))
+          ^ open[l];
+      if (change) {
+        for (int l=0; l<nl; l++) {
+          char p = ((y[l]<=r1[l]) & a1[l]) | ((y[l]>=r2[l]) & a2[l]);
+          if (p != open[l]) {
+            pegedge(cl + l, t + k, p);
+            open[l] = p;
+          }
+        }
+      }
+      y += sstep;
+    }
+    t += n;
+  }
+  for (int c=cl; c<cl+nl; c++)
+    if (scanned[c] < t_to)
+      scanned[c] = t_to;
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::prescancolumn(int c, timeref_t t_to) {
+  Sample r1 = rail1[c];
+  Sample r2 = rail2[c];
+  char a1 = armed1[c];
+  char a2 = armed2[c];
+  char open = !pegruns[c].empty() && pegruns[c].back().end==INFTY;
+  timeref_t t_end = sources[c].end();
+  timeref_t t = scanned[c];
+  while (t<t_to) {
+    if (t>=t_end) {
+      // past the end of a bounded buffer: pegged for good
+      if (!open)
+        pegedge(c, t, true);
+      break;
+    }
+    int n = SCANBLOCK;
+    if (t_to - t < timeref_t(n))
+      n = t_to - t;
+    if (t_end - t < timeref_t(n))
+      n = t_end - t;
+    Sample y[SCANBLOCK];
+    sources[c].read(y, t, n);
+    char change = 0;
+    for (int m=0; m<n; m++)
+      change |= (((y[m]<=r1) & a1) | ((y[m]>=r2) & a2)) ^ open;
+    if (change) {
+      for (int m=0; m<n; m++) {
+        char p = ((y[m]<=r1) & a1) | ((y[m]>=r2) & a2);
+        if (p != open) {
+          pegedge(c, t + m, p);
+          open = p;
+        }
+      }
+    }
+    t += n;
+  }
+  if (scanned[c] < t_to)
+    scanned[c] = t_to;
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::pegedge(int c, timeref_t t,
+                                                bool pegged) {
+  if (pegged) {
+    Run r;
+    r.start = t;
+    r.end = INFTY;
+    pegruns[c].push_back(r);
+  } else {
+    pegruns[c].back().end = t;
+  }
+}
+
+template <typename Sample, typename Buffer>
+auto BasicLocalFitBank<Sample, Buffer>::findrun(int c, timeref_t t) const
+  -> Run const * {
+  // Returns the first run that ends after T, or null if there is none.
+  std::vector<Run> const &runs = pegruns[c];
+  for (std::size_t k=peghead[c]; k<runs.size(); k++)
+    if (runs[k].end > t)
+      return &runs[k];
+  return 0;
+}
+
+template <typename Sample, typename Buffer>
+timeref_t BasicLocalFitBank<Sample, Buffer>::nextpeg(int c,
+                                                     timeref_t t) const {
+  // Returns the first pegged sample at or after T, or INFTY.
+  Run const *r = findrun(c, t);
+  if (!r)
+    return INFTY;
+  return r->start > t ? r->start : t;
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::prunepegs(int c, timeref_t t) {
+  // Forgets about runs that end at or before T.
+  std::vector<Run> &runs = pegruns[c];
+  std::size_t &k = peghead[c];
+  while (k<runs.size() && runs[k].end<=t)
+    k++;
+  if (k>=64 && 2*k>=runs.size()) {
+    runs.erase(runs.begin(), runs.begin() + k);
+    k = 0;
+  }
+}
+
+//--------------------------------------------------------------------
+// debug
+//
+template <typename Sample, typename Buffer>
+char const *BasicLocalFitBank<Sample, Buffer>::stateName(State s) {
+  switch (s) {
+  case State::OK: return "OK";
+  case State::PEGGING: return "Pegging";
+  case State::PEGGED: return "Pegged";
+  case State::TOOPOOR: return "TooPoor";
+  case State::DEPEGGING: return "Depegging";
+  case State::FORCEPEG: return "ForcePeg";
+  case State::BLANKDEPEG: return "BlankDepeg";
+  case State::DEAD: return "Dead";
+  default: return "???";
+  }
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::report(int c) {
+  std::cerr << "channel=" << c;
+  std::cerr << " state=" << stateName(state[c]);
+  std::cerr << " t_stream=" << t_stream[c];
+  std::cerr << " t0=" << t0[c];
+  std::cerr << " y[t]=" << sources[c][t_stream[c]];
+  std::cerr << " alpha=" << alpha0[c] << " " << alpha1[c]
+            << " " << alpha2[c] << " " << alpha3[c];
+  std::cerr << " X=" << X0[c] << " " << X1[c]
+            << " " << X2[c] << " " << X3[c];
+  std::cerr << "\n";
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::inirep() {
+  std::cerr << "tau=" << tau;
+  std::cerr << " T0/2/4/6=" << T0 << " " << T2
+            << " " << T4 << " " << T6;
+  std::cerr << "\n";
+}
+
+template <typename Sample, typename Buffer>
+void BasicLocalFitBank<Sample, Buffer>::crash(char const *msg) {
+  std::cerr << "LocalFit: " << msg << "\n";
+  std::exit(1);
+}
+
+#endif
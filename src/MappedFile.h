@@ -0,0 +1,127 @@
+// MappedFile.h
+
+#ifndef MAPPEDFILE_H
+
+#define MAPPEDFILE_H
+
+/* A MappedFile maps LENGTH bytes of a file, starting at OFFSET, into
+   memory, so that salpa can work on the samples where they are rather
+   than read them into a ring buffer first. The mapping is private:
+   writes (such as baseline subtraction with -B) go to copies of the
+   pages concerned, never to the file. The kernel is told that access
+   will be sequential, so that it reads ahead, and DISCARD tells it
+   that everything before a given point is no longer needed.
+
+   If the file is shorter, the mapping ends with the file, which SIZE
+   reports. Either way, it is followed by PAD bytes of zeros, for
+   readers that look a little beyond the end. If the file cannot be
+   mapped at all, or on systems without mmap, OK returns false.
+*/
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+public:
+  MappedFile(char const *fn, std::uint64_t offset, std::uint64_t length,
+             std::uint64_t pad=0):
+    base(0), maplen(0), ptr(0), len(0), discarded(0) {
+#if defined(__linux__) || defined(__APPLE__)
+    int fd = open(fn, O_RDONLY);
+    if (fd<0)
+      return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || std::uint64_t(st.st_size) <= offset) {
+      close(fd);
+      return;
+    }
+    bool whole = length >= st.st_size - offset;
+    if (whole)
+      length = st.st_size - offset;
+    std::uint64_t page = sysconf(_SC_PAGESIZE);
+    std::uint64_t skip = offset % page;
+    /* Reserve address space for the padding too, then map the file
+       over the start and fresh pages over the rest. Nothing is charged
+       against the commit limit up front (MAP_NORESERVE), since the
+       file may well be larger than memory; only pages that are
+       written to need room.
+    */
+    std::uint64_t filelen = (skip + length + page - 1) & ~(page - 1);
+    std::uint64_t total = (skip + length + pad + page - 1) & ~(page - 1);
+    void *p = mmap(0, total, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      return;
+    }
+    void *q = mmap(p, skip + length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_FIXED | NORESERVE, fd, offset - skip);
+    close(fd);
+    if (q != MAP_FAILED && total > filelen)
+      q = mmap((char*)p + filelen, total - filelen, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | NORESERVE, -1, 0);
+    if (q == MAP_FAILED) {
+      munmap(p, total);
+      return;
+    }
+    madvise(p, skip + length, MADV_SEQUENTIAL);
+    base = (char*)p;
+    maplen = total;
+    ptr = base + skip;
+    len = length;
+    if (!whole) // the rest of the last page holds more of the file
+      std::memset(ptr + length, 0, filelen - skip - length);
+#else
+    (void)fn;
+    (void)offset;
+    (void)length;
+    (void)pad;
+#endif
+  }
+  MappedFile(MappedFile const &) = delete;
+  MappedFile &operator=(MappedFile const &) = delete;
+  ~MappedFile() {
+#if defined(__linux__) || defined(__APPLE__)
+    if (base)
+      munmap(base, maplen);
+#endif
+  }
+  bool ok() const { return base!=0; }
+  char *data() { return ptr; }
+  std::uint64_t size() const { return len; }
+  void discard(std::uint64_t upto) {
+    // Lets go of the pages that lie entirely before byte UPTO.
+#if defined(__linux__) || defined(__APPLE__)
+    std::uint64_t page = sysconf(_SC_PAGESIZE);
+    std::uint64_t end = (ptr - base + upto) & ~(page - 1);
+    if (end > maplen)
+      end = maplen & ~(page - 1);
+    if (end > discarded) {
+      madvise(base + discarded, end - discarded, MADV_DONTNEED);
+      discarded = end;
+    }
+#else
+    (void)upto;
+#endif
+  }
+private:
+#if defined(MAP_NORESERVE)
+  static constexpr int NORESERVE = MAP_NORESERVE;
+#else
+  static constexpr int NORESERVE = 0;
+#endif
+  char *base; // start of the mapping, on a page boundary
+  std::size_t maplen;
+  char *ptr; // the byte at OFFSET
+  std::uint64_t len;
+  std::uint64_t discarded; // from BASE
+};
+
+#endif
@@ -0,0 +1,300 @@
+// Placement.h
+
+#ifndef PLACEMENT_H
+
+#define PLACEMENT_H
+
+/* Control over where salpa's big sample buffers live and where its
+   worker threads run, for multi-socket machines.
+
+   A BigBuf is a 64-byte aligned array. With HUGE, it is mapped
+   directly from the kernel in 2 MB huge pages (reserved ones if any
+   are available, transparent ones otherwise) and left untouched, so
+   that each page lands on the NUMA node of the thread that first
+   writes to it. Without HUGE, or on systems other than Linux, it is
+   ordinary zeroed heap memory.
+
+   With TWICE, a BigBuf of N elements is backed by a memory file that
+   is mapped twice, back to back, so that DATA()[N+k] is the same
+   element as DATA()[k]. A ring buffer on top of that never has to
+   split a stretch at its wrap point. This needs Linux and a size that
+   is a whole number of pages; if it cannot be done, the buffer is not
+   mirrored, which MIRRORED() reports.
+
+   A Topology lists the CPUs this process may run on, grouped by NUMA
+   node, as read from /sys. SPREAD picks CPUs for a number of workers
+   so that consecutive workers share a node and the nodes are used in
+   proportion to their size.
+*/
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <algorithm>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+template <typename T> class BigBuf {
+public:
+  static constexpr std::size_t ALIGN = 64;
+  static constexpr std::size_t HUGEPAGE = 2*1024*1024;
+public:
+  BigBuf(): ptr(0), n(0), base(0), bytes(0), mapped(false), mirror(false) { }
+  BigBuf(std::size_t n, bool huge=false, bool twice=false):
+    ptr(0), n(n), base(0), bytes(0), mapped(false), mirror(false) {
+    if (twice && ((huge && mapmirror(true)) || mapmirror(false)))
+      return;
+    if (huge && map())
+      return;
+    bytes = n*sizeof(T) + ALIGN;
+    base = new char[bytes];
+    std::uintptr_t a = std::uintptr_t(base);
+    ptr = (T*)((a + ALIGN - 1) & ~std::uintptr_t(ALIGN - 1));
+    std::fill(ptr, ptr + n, T(0));
+  }
+  BigBuf(BigBuf const &) = delete;
+  BigBuf &operator=(BigBuf const &) = delete;
+  BigBuf(BigBuf &&b): ptr(b.ptr), n(b.n), base(b.base), bytes(b.bytes),
+                      mapped(b.mapped), mirror(b.mirror) {
+    b.ptr = 0;
+    b.n = 0;
+    b.base = 0;
+  }
+  BigBuf &operator=(BigBuf &&b) {
+    std::swap(ptr, b.ptr);
+    std::swap(n, b.n);
+    std::swap(base, b.base);
+    std::swap(bytes, b.bytes);
+    std::swap(mapped, b.mapped);
+    std::swap(mirror, b.mirror);
+    return *this;
+  }
+  ~BigBuf() {
+    release();
+  }
+  T *data() { return ptr; }
+  T const *data() const { return ptr; }
+  std::size_t size() const { return n; }
+  bool huge() const { return mapped; }
+  bool mirrored() const { return mirror; }
+private:
+  bool mapmirror(bool hugetlb) {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    std::size_t len = n*sizeof(T);
+    std::size_t page = hugetlb ? HUGEPAGE : sysconf(_SC_PAGESIZE);
+    if (len==0 || len % page)
+      return false;
+    int fd = memfd_create("salpa", MFD_CLOEXEC | (hugetlb ? MFD_HUGETLB : 0));
+    if (fd<0)
+      return false;
+    if (ftruncate(fd, len) != 0) {
+      close(fd);
+      return false;
+    }
+    // Reserve room for both copies, aligned to a page, then map the
+    // file over each half.
+    void *p = mmap(0, 2*len + page, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    std::uintptr_t a = std::uintptr_t(p);
+    std::uintptr_t b = (a + page - 1) & ~std::uintptr_t(page - 1);
+    if (b > a)
+      munmap(p, b - a);
+    munmap((void*)(b + 2*len), a + page - b);
+    bool ok = true;
+    for (int k=0; k<2; k++)
+      if (mmap((void*)(b + k*len), len, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+        ok = false;
+    close(fd);
+    if (!ok) {
+      munmap((void*)b, 2*len);
+      return false;
+    }
+    base = (char*)b;
+    bytes = 2*len;
+    ptr = (T*)base;
+    mapped = true;
+    mirror = true;
+    return true;
+#else
+    (void)hugetlb;
+    return false;
+#endif
+  }
+  bool map() {
+#if defined(__linux__)
+    std::size_t len = (n*sizeof(T) + HUGEPAGE - 1) & ~(HUGEPAGE - 1);
+    if (len==0)
+      return false;
+    void *p = mmap(0, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      base = (char*)p;
+      bytes = len;
+    } else {
+      // No reserved huge pages: map extra so we can align to 2 MB
+      // ourselves, then ask for transparent huge pages.
+      p = mmap(0, len + HUGEPAGE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED)
+        return false;
+      std::uintptr_t a = std::uintptr_t(p);
+      std::uintptr_t b = (a + HUGEPAGE - 1) & ~std::uintptr_t(HUGEPAGE - 1);
+      if (b > a)
+        munmap(p, b - a);
+      if (b + len < a + len + HUGEPAGE)
+        munmap((void*)(b + len), a + HUGEPAGE - b);
+      base = (char*)b;
+      bytes = len;
+      madvise(base, len, MADV_HUGEPAGE);
+    }
+    ptr = (T*)base;
+    mapped = true;
+    return true;
+#else
+    return false;
+#endif
+  }
+  void release() {
+#if defined(__linux__)
+    if (mapped) {
+      if (base)
+        munmap(base, bytes);
+      return;
+    }
+#endif
+    delete [] base;
+  }
+private:
+  T *ptr;
+  std::size_t n;
+  char *base;
+  std::size_t bytes;
+  bool mapped;
+  bool mirror; // second copy of the pages follows the first
+};
+
+inline bool pinthread(int cpu) {
+  // Pins the calling thread to the given CPU. Returns false if that is
+  // not possible.
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set)==0;
+#else
+  return false;
+#endif
+}
+
+class Topology {
+public:
+  Topology() {
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool any = sched_getaffinity(0, sizeof(allowed), &allowed)==0;
+    DIR *dir = opendir("/sys/devices/system/node");
+    std::vector<int> nodeids;
+    if (dir) {
+      while (dirent *e = readdir(dir)) {
+        int id;
+        char tail;
+        if (std::sscanf(e->d_name, "node%i%c", &id, &tail)==1)
+          nodeids.push_back(id);
+      }
+      closedir(dir);
+    }
+    std::sort(nodeids.begin(), nodeids.end());
+    for (int id: nodeids) {
+      char fn[100];
+      std::snprintf(fn, sizeof(fn),
+                    "/sys/devices/system/node/node%i/cpulist", id);
+      std::vector<int> list = readcpulist(fn);
+      bool used = false;
+      for (int c: list) {
+        if (c<CPU_SETSIZE && (!any || CPU_ISSET(c, &allowed))) {
+          cpus.push_back(c);
+          nodes.push_back(nnodes);
+          used = true;
+        }
+      }
+      if (used)
+        nnodes++;
+    }
+    if (cpus.empty()) {
+      for (int c=0; c<CPU_SETSIZE; c++) {
+        if (any ? CPU_ISSET(c, &allowed) : c<int(std::thread::hardware_concurrency())) {
+          cpus.push_back(c);
+          nodes.push_back(0);
+        }
+      }
+      nnodes = 1;
+    }
+#endif
+  }
+  int nodecount() const { return nnodes; }
+  int cpucount() const { return cpus.size(); }
+  std::vector<int> spread(int nworkers) const {
+    // CPUs for NWORKERS workers, empty if we know of none.
+    std::vector<int> res;
+    int ncpus = cpus.size();
+    if (ncpus==0)
+      return res;
+    for (int k=0; k<nworkers; k++)
+      res.push_back(cpus[(std::int64_t(k)*ncpus/nworkers) % ncpus]);
+    return res;
+  }
+  int nodeof(int cpu) const {
+    for (unsigned k=0; k<cpus.size(); k++)
+      if (cpus[k]==cpu)
+        return nodes[k];
+    return -1;
+  }
+private:
+  static std::vector<int> readcpulist(char const *fn) {
+    // Parses a list like "0-15,32-47".
+    std::vector<int> res;
+    FILE *f = std::fopen(fn, "r");
+    if (!f)
+      return res;
+    char buf[4096];
+    if (std::fgets(buf, sizeof(buf), f)) {
+      char *s = buf;
+      while (*s) {
+        char *e;
+        long a = std::strtol(s, &e, 10);
+        if (e==s)
+          break;
+        long b = a;
+        if (*e=='-')
+          b = std::strtol(e+1, &e, 10);
+        for (long c=a; c<=b; c++)
+          res.push_back(int(c));
+        s = e;
+        if (*s==',')
+          s++;
+      }
+    }
+    std::fclose(f);
+    return res;
+  }
+private:
+  std::vector<int> cpus; // grouped by node
+  std::vector<int> nodes; // index of node for each of CPUS
+  int nnodes = 0;
+};
+
+#endif
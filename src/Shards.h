@@ -0,0 +1,289 @@
+// Shards.h
+
+#ifndef SHARDS_H
+
+#define SHARDS_H
+
+/* A large recording can be cut into shards, by group of channels and
+   by stretch of time, that are run through salpa as separate jobs,
+   perhaps on separate machines. A ShardPlan says where each shard's
+   output goes in the final file, and MERGE puts the final file
+   together from the shard outputs.
+
+   A shard's output holds scans FROM up to TO of the final output.
+   Its COLUMNS say, for each channel in its scans, which channel of
+   the final output that is, or -1 if the channel is only there to
+   help (for instance, a trigger channel that another shard outputs).
+   For each stretch of time, each channel of the final output must
+   come from exactly one shard.
+
+   A plan is kept as comment lines in the script that runs the shards
+   (see "salpa plan"):
+
+     # output FILENAME NCOLUMNS NSCANS
+     # shard FILENAME FROM TO COLUMNS
+
+   where COLUMNS is a comma-separated list of output channels and
+   ranges thereof, with "x" for channels that are not used. Other lines
+   are ignored. Filenames may contain spaces, but not newlines.
+*/
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <sys/stat.h>
+#include "LocalFitBank.h"
+
+inline std::uint64_t filelength(char const *fn) {
+  // Returns the size of file FN in bytes, or zero if it cannot be had.
+#if defined(_WIN32)
+  struct _stat64 st;
+  if (_stat64(fn, &st) != 0)
+    return 0;
+#else
+  struct stat st;
+  if (stat(fn, &st) != 0)
+    return 0;
+#endif
+  return st.st_size;
+}
+
+struct Shard {
+  std::string file;
+  timeref_t from, to;
+  std::vector<int> columns;
+};
+
+class ShardPlan {
+public:
+  ShardPlan(): ncolumns(0), nscans(0) { }
+  std::string output;
+  int ncolumns;
+  timeref_t nscans;
+  std::vector<Shard> shards;
+public:
+  std::string outputline() const {
+    std::ostringstream s;
+    s << "# output " << output << " " << ncolumns << " " << nscans;
+    return s.str();
+  }
+  static std::string shardline(Shard const &sh) {
+    std::ostringstream s;
+    s << "# shard " << sh.file << " " << sh.from << " " << sh.to << " ";
+    for (unsigned k=0; k<sh.columns.size(); ) {
+      if (k)
+        s << ",";
+      unsigned n = 1;
+      if (sh.columns[k]<0) {
+        s << "x";
+      } else {
+        while (k+n<sh.columns.size() && sh.columns[k+n]==sh.columns[k]+int(n))
+          n++;
+        s << sh.columns[k];
+        if (n>1)
+          s << "-" << sh.columns[k]+n-1;
+      }
+      k += n;
+    }
+    return s.str();
+  }
+  bool read(char const *fn) {
+    // Returns false, after complaining, if FN is not a usable plan.
+    std::ifstream f(fn);
+    if (!f) {
+      std::cerr << "Cannot open plan file\n";
+      return false;
+    }
+    std::string line;
+    while (std::getline(f, line)) {
+      if (line.compare(0, 9, "# output ")==0) {
+        std::vector<std::string> w = lastwords(line.substr(9), 2);
+        if (w.size()!=3)
+          return bad(line);
+        output = w[0];
+        ncolumns = std::atoi(w[1].c_str());
+        nscans = std::strtoull(w[2].c_str(), 0, 10);
+      } else if (line.compare(0, 8, "# shard ")==0) {
+        std::vector<std::string> w = lastwords(line.substr(8), 3);
+        if (w.size()!=4)
+          return bad(line);
+        Shard sh;
+        sh.file = w[0];
+        sh.from = std::strtoull(w[1].c_str(), 0, 10);
+        sh.to = std::strtoull(w[2].c_str(), 0, 10);
+        std::istringstream cols(w[3]);
+        std::string item;
+        while (std::getline(cols, item, ',')) {
+          if (item=="x") {
+            sh.columns.push_back(-1);
+          } else {
+            char *e;
+            long a = std::strtol(item.c_str(), &e, 10);
+            long b = *e=='-' ? std::strtol(e+1, &e, 10) : a;
+            if (*e || e==item.c_str() || a<0 || b<a)
+              return bad(line);
+            for (long c=a; c<=b; c++)
+              sh.columns.push_back(c);
+          }
+        }
+        shards.push_back(sh);
+      }
+    }
+    return check();
+  }
+  bool merge() const {
+    /* Writes the output, one stretch of time after the other, reading
+       all the shards of a stretch in step. Returns false, after
+       complaining, if a shard cannot be read.
+    */
+    FILE *out = std::fopen(output.c_str(), "wb");
+    if (!out) {
+      std::cerr << "Cannot open output file\n";
+      return false;
+    }
+    const int BLOCK = 4096; // scans
+    std::vector<raw_t> dst(std::size_t(BLOCK)*ncolumns);
+    for (std::vector<int> const &stretch: stretches()) {
+      std::vector<FILE *> ins;
+      std::vector<std::vector<raw_t>> srcs;
+      bool ok = true;
+      for (int s: stretch) {
+        Shard const &sh = shards[s];
+        int ncols = sh.columns.size();
+        ins.push_back(std::fopen(sh.file.c_str(), "rb"));
+        srcs.push_back(std::vector<raw_t>(std::size_t(BLOCK)*ncols));
+        if (!ins.back()
+            || filelength(sh.file.c_str())
+               != (sh.to - sh.from)*ncols*sizeof(raw_t)) {
+          std::cerr << "Shard " << sh.file << " is missing or incomplete\n";
+          ok = false;
+        }
+      }
+      Shard const &first = shards[stretch[0]];
+      for (timeref_t t=first.from; ok && t<first.to; t+=BLOCK) {
+        int n = first.to - t < timeref_t(BLOCK) ? first.to - t : BLOCK;
+        for (unsigned k=0; k<stretch.size(); k++) {
+          std::vector<int> const &cols = shards[stretch[k]].columns;
+          int ncols = cols.size();
+          if (int(std::fread(srcs[k].data(), sizeof(raw_t)*ncols, n, ins[k]))
+              != n) {
+            std::cerr << "Cannot read shard " << shards[stretch[k]].file
+                      << "\n";
+            ok = false;
+            break;
+          }
+          raw_t const *src = srcs[k].data();
+          raw_t *d = dst.data();
+          for (int i=0; i<n; i++) {
+            for (int j=0; j<ncols; j++)
+              if (cols[j]>=0)
+                d[cols[j]] = src[j];
+            src += ncols;
+            d += ncolumns;
+          }
+        }
+        if (ok && int(std::fwrite(dst.data(), sizeof(raw_t)*ncolumns, n, out))
+            != n) {
+          std::cerr << "Cannot write output file\n";
+          ok = false;
+        }
+      }
+      for (FILE *in: ins)
+        if (in)
+          std::fclose(in);
+      if (!ok) {
+        std::fclose(out);
+        return false;
+      }
+    }
+    if (std::fclose(out) != 0) {
+      std::cerr << "Cannot write output file\n";
+      return false;
+    }
+    return true;
+  }
+private:
+  static std::vector<std::string> lastwords(std::string s, int n) {
+    /* Splits off the last N words of S. The result has the rest of S,
+       which may contain spaces, in front.
+    */
+    std::vector<std::string> w;
+    for (int k=0; k<n; k++) {
+      std::size_t sp = s.find_last_of(' ');
+      if (sp==std::string::npos || sp==0)
+        return std::vector<std::string>();
+      w.insert(w.begin(), s.substr(sp+1));
+      s = s.substr(0, sp);
+    }
+    w.insert(w.begin(), s);
+    return w;
+  }
+  static bool bad(std::string const &line) {
+    std::cerr << "Bad line in plan: " << line << "\n";
+    return false;
+  }
+  std::vector<std::vector<int>> stretches() const {
+    // Groups the shards by stretch of time, in order.
+    std::vector<std::vector<int>> res;
+    std::vector<int> order(shards.size());
+    for (unsigned s=0; s<shards.size(); s++)
+      order[s] = s;
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+      return shards[a].from < shards[b].from;
+    });
+    for (int s: order) {
+      if (res.empty() || shards[res.back()[0]].from != shards[s].from)
+        res.push_back(std::vector<int>());
+      res.back().push_back(s);
+    }
+    return res;
+  }
+  bool check() const {
+    // Makes sure that each output channel comes from exactly one shard.
+    if (output.empty() || ncolumns<1 || shards.empty()) {
+      std::cerr << "Incomplete plan\n";
+      return false;
+    }
+    timeref_t t = 0;
+    for (std::vector<int> const &stretch: stretches()) {
+      std::vector<int> uses(ncolumns, 0);
+      for (int s: stretch) {
+        Shard const &sh = shards[s];
+        if (sh.from != t || sh.to != shards[stretch[0]].to || sh.to <= t) {
+          std::cerr << "Shards do not line up at scan " << t << "\n";
+          return false;
+        }
+        for (int c: sh.columns) {
+          if (c>=ncolumns) {
+            std::cerr << "Shard " << sh.file << " has too many columns\n";
+            return false;
+          }
+          if (c>=0)
+            uses[c]++;
+        }
+      }
+      for (int c=0; c<ncolumns; c++) {
+        if (uses[c]!=1) {
+          std::cerr << "Output channel " << c << " is in " << uses[c]
+                    << " shards at scan " << t << "\n";
+          return false;
+        }
+      }
+      t = shards[stretch[0]].to;
+    }
+    if (t != nscans) {
+      std::cerr << "Shards end at scan " << t << " rather than "
+                << nscans << "\n";
+      return false;
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,200 @@
+// Stages.h
+
+#ifndef STAGES_H
+
+#define STAGES_H
+
+/* Reading and writing for salpa, each on a thread of its own, so that
+   the disk does not sit idle while LocalFit works and vice versa.
+
+   A ReadStage reads fragments of scans from a file into an interleaved
+   ring buffer, as far ahead as the ring allows, from START up to the
+   end of the file or END, whichever comes first. The handoff with the
+   thread that uses the data is through two counters, each written by
+   one side only: FILLED (scans before this are valid) and RELEASED
+   (scans before this are no longer needed and may be overwritten).
+
+   A WriteStage writes scans from an interleaved ring buffer to a file,
+   starting at scan FROM, one fragment at a time, as soon as they are
+   published as READY. It
+   reports its progress as SAVED.
+
+   Both ring BELL whenever their counter moves, so that the other side
+   can sleep until then. Both convert between the file layout and
+   salpa's own according to a ChannelMap, unless that is the identity.
+*/
+
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <vector>
+#include "CyclBuf.h"
+#include "Doorbell.h"
+#include "ChannelMap.h"
+#include "LocalFitBank.h"
+
+class ReadStage {
+public:
+  ReadStage(FILE *in, CyclBuf<raw_t> &buf, ChannelMap const &map,
+            int fragsams, timeref_t start, timeref_t end, Doorbell &bell):
+    in(in), buf(buf), map(map), fragsams(fragsams), end(end), bell(bell),
+    filledto(start), releasedto(0), at_eof(false), quit(false) {
+    if (!map.identity())
+      scratch.resize(std::size_t(fragsams)*map.filecount());
+    thr = std::thread(&ReadStage::run, this);
+  }
+  ~ReadStage() {
+    quit = true;
+    mybell.ring();
+    if (thr.joinable())
+      thr.join();
+  }
+  bool eof() const {
+    // Check this before FILLED, so that the latter is final if true.
+    return at_eof.load();
+  }
+  timeref_t filled() const {
+    return filledto.load();
+  }
+  void release(timeref_t t) {
+    if (t > releasedto.load()) {
+      releasedto.store(t);
+      mybell.ring();
+    }
+  }
+  bool full(timeref_t filled) const {
+    // True if, having read up to FILLED, we cannot go on until RELEASE.
+    return filled + fragsams > releasedto.load() + buf.size();
+  }
+private:
+  void run() {
+    timeref_t t = filledto.load();
+    while (!quit) {
+      int seen = mybell.peek();
+      if (full(t)) {
+        mybell.wait(seen);
+        continue;
+      }
+      int want = end - t < timeref_t(fragsams) ? end - t : fragsams;
+      CyclBuf<raw_t>::Span rows[2];
+      int n = buf.spans(t, want, rows);
+      int got = 0;
+      for (int s=0; s<n; s++) {
+        int k;
+        if (map.identity()) {
+          k = std::fread(rows[s].data, sizeof(raw_t)*buf.step(),
+                         rows[s].count, in);
+        } else {
+          k = std::fread(scratch.data(), sizeof(raw_t)*map.filecount(),
+                         rows[s].count, in);
+          map.unpack(scratch.data(), rows[s].data, buf.step(), k);
+        }
+        got += k;
+        if (k != rows[s].count)
+          break;
+      }
+      t += got;
+      filledto.store(t);
+      if (got != fragsams)
+        at_eof.store(true);
+      bell.ring();
+      if (got != fragsams)
+        break;
+    }
+  }
+private:
+  FILE *in;
+  CyclBuf<raw_t> &buf;
+  ChannelMap const &map;
+  std::vector<raw_t> scratch; // one fragment in the file layout
+  int fragsams;
+  timeref_t end;
+  Doorbell &bell; // the consumer's
+  Doorbell mybell;
+  std::atomic<timeref_t> filledto;
+  std::atomic<timeref_t> releasedto;
+  std::atomic<bool> at_eof;
+  std::atomic<bool> quit;
+  std::thread thr;
+};
+
+class WriteStage {
+public:
+  WriteStage(FILE *out, CyclBuf<raw_t> const &buf, ChannelMap const &map,
+             int fragsams, timeref_t from, Doorbell &bell):
+    out(out), buf(buf), map(map), fragsams(fragsams), bell(bell),
+    readyto(from), savedto(from), finished(false), quit(false) {
+    if (!map.identity())
+      scratch.resize(std::size_t(fragsams)*map.keepcount());
+    thr = std::thread(&WriteStage::run, this);
+  }
+  ~WriteStage() {
+    quit = true;
+    mybell.ring();
+    if (thr.joinable())
+      thr.join();
+  }
+  timeref_t saved() const {
+    return savedto.load();
+  }
+  void publish(timeref_t t) {
+    if (t > readyto.load()) {
+      readyto.store(t);
+      mybell.ring();
+    }
+  }
+  void finish(timeref_t t) {
+    // Writes everything up to T and returns when done.
+    readyto.store(t);
+    finished = true;
+    mybell.ring();
+    if (thr.joinable())
+      thr.join();
+  }
+private:
+  void run() {
+    timeref_t t = savedto.load();
+    while (!quit) {
+      int seen = mybell.peek();
+      bool fin = finished.load();
+      timeref_t ready = readyto.load();
+      if (t<ready) {
+        int count = ready - t < timeref_t(fragsams) ? ready - t : fragsams;
+        CyclBuf<raw_t>::Span rows[2];
+        int n = buf.spans(t, count, rows);
+        for (int s=0; s<n; s++) {
+          if (map.identity()) {
+            std::fwrite(rows[s].data, sizeof(raw_t)*buf.step(),
+                        rows[s].count, out);
+          } else {
+            map.pack(rows[s].data, buf.step(), scratch.data(), rows[s].count);
+            std::fwrite(scratch.data(), sizeof(raw_t)*map.keepcount(),
+                        rows[s].count, out);
+          }
+        }
+        t += count;
+        savedto.store(t);
+        bell.ring();
+      } else if (fin) {
+        break;
+      } else {
+        mybell.wait(seen);
+      }
+    }
+  }
+private:
+  FILE *out;
+  CyclBuf<raw_t> const &buf;
+  ChannelMap const &map;
+  std::vector<raw_t> scratch; // one fragment in the output layout
+  int fragsams;
+  Doorbell &bell; // the producer's
+  Doorbell mybell;
+  std::atomic<timeref_t> readyto;
+  std::atomic<timeref_t> savedto;
+  std::atomic<bool> finished;
+  std::atomic<bool> quit;
+  std::thread thr;
+};
+
+#endif
@@ -0,0 +1,162 @@
+// Trace.h
+
+#ifndef TRACE_H
+
+#define TRACE_H
+
+/* A structured trace of the state transitions in LocalFitBank, so
+   that one can find out after the fact why a channel did what it did
+   (for instance, why it stayed in TOOPOOR for so long) without
+   rerunning under a debugger.
+
+   Tracing is selected at compile time. Unless SALPA_TRACE is defined
+   to be nonzero, Trace::record() is an empty inline function, and the
+   state machine compiles exactly as it would without it. With
+   tracing, each thread appends fixed-size binary records to a ring
+   buffer of its own, so that no locking is needed on the hot path.
+   When a ring is full, its oldest records are overwritten. Trace::save()
+   writes all rings to a file, which salpa-trace converts to CSV.
+*/
+
+#ifndef SALPA_TRACE
+#define SALPA_TRACE 0
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if SALPA_TRACE
+#include <memory>
+#include <mutex>
+#endif
+
+enum class TraceKind: std::uint8_t {
+  PEG,      // OK -> PEGGING; value is the sample ahead that triggered it
+  FORCEPEG, // forced peg; value is its length in samples
+  REPEG,    // PEGGED or TOOPOOR -> FORCEPEG because another peg came
+  TOOPOOR,  // PEGGED -> TOOPOOR; value is the asymmetry
+  RETRY,    // countdown in TOOPOOR restarted; value is the asymmetry
+  DEPEG,    // TOOPOOR -> BLANKDEPEG; value is the asymmetry
+  RESUME,   // DEPEGGING -> OK
+  NKINDS
+};
+/* Asymmetries are reported relative to the threshold: a channel
+   leaves TOOPOOR after TOOPOORCNT consecutive samples below 1, the
+   last of which must be below 1/3.92.
+*/
+
+struct TraceEvent {
+  std::uint64_t t; // sample index
+  std::int32_t channel;
+  float value;
+  std::uint16_t thread;
+  std::uint8_t kind;
+  std::uint8_t reserved[5];
+};
+static_assert(sizeof(TraceEvent)==24, "TraceEvent must be packed");
+
+struct TraceHeader {
+  char magic[8]; // "SALPATRC"
+  std::uint32_t version;
+  std::uint32_t recordsize;
+  std::uint64_t dropped; // records lost to ring overflow
+};
+
+class Trace {
+public:
+  static constexpr int LOG2CAPACITY = 16; // records per thread
+  static constexpr std::uint32_t VERSION = 1;
+  static char const *kindName(TraceKind k) {
+    switch (k) {
+    case TraceKind::PEG: return "PEG";
+    case TraceKind::FORCEPEG: return "FORCEPEG";
+    case TraceKind::REPEG: return "REPEG";
+    case TraceKind::TOOPOOR: return "TOOPOOR";
+    case TraceKind::RETRY: return "RETRY";
+    case TraceKind::DEPEG: return "DEPEG";
+    case TraceKind::RESUME: return "RESUME";
+    default: return "?";
+    }
+  }
+#if SALPA_TRACE
+public:
+  static constexpr bool enabled = true;
+  static void record(TraceKind kind, int channel, std::uint64_t t,
+                     double value=0) {
+    static thread_local Ring *ring = attach();
+    TraceEvent &e = ring->events[ring->count & MASK];
+    e.t = t;
+    e.channel = channel;
+    e.value = float(value);
+    e.thread = ring->thread;
+    e.kind = std::uint8_t(kind);
+    ring->count++;
+  }
+  static bool save(char const *fn,
+                   std::vector<int> const &channels=std::vector<int>()) {
+    /* Writes all rings, each oldest first. Call when no thread is
+       recording. CHANNELS, if given, says which channel to report for
+       each of the fitters' channels.
+    */
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mut);
+    FILE *fd = std::fopen(fn, "wb");
+    if (!fd)
+      return false;
+    TraceHeader hdr;
+    std::memcpy(hdr.magic, "SALPATRC", 8);
+    hdr.version = VERSION;
+    hdr.recordsize = sizeof(TraceEvent);
+    hdr.dropped = 0;
+    for (auto const &r: reg.rings)
+      if (r->count > CAPACITY)
+        hdr.dropped += r->count - CAPACITY;
+    bool ok = std::fwrite(&hdr, sizeof(hdr), 1, fd)==1;
+    for (auto const &r: reg.rings) {
+      std::uint64_t n = r->count < CAPACITY ? r->count : CAPACITY;
+      std::uint64_t k0 = r->count - n;
+      for (std::uint64_t k=k0; k<r->count && ok; k++) {
+        TraceEvent e = r->events[k & MASK];
+        if (e.channel < int(channels.size()))
+          e.channel = channels[e.channel];
+        ok = std::fwrite(&e, sizeof(TraceEvent), 1, fd)==1;
+      }
+    }
+    return std::fclose(fd)==0 && ok;
+  }
+private:
+  static constexpr std::uint64_t CAPACITY = std::uint64_t(1) << LOG2CAPACITY;
+  static constexpr std::uint64_t MASK = CAPACITY - 1;
+  struct Ring {
+    Ring(int thread): events(CAPACITY), count(0), thread(thread) { }
+    std::vector<TraceEvent> events;
+    std::uint64_t count;
+    std::uint16_t thread;
+  };
+  struct Registry {
+    std::mutex mut;
+    std::vector<std::unique_ptr<Ring>> rings; // outlive their threads
+  };
+  static Registry &registry() {
+    static Registry reg;
+    return reg;
+  }
+  static Ring *attach() {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mut);
+    reg.rings.emplace_back(new Ring(reg.rings.size()));
+    return reg.rings.back().get();
+  }
+#else
+public:
+  static constexpr bool enabled = false;
+  static void record(TraceKind, int, std::uint64_t, double=0) { }
+  static bool save(char const *, std::vector<int> const & =std::vector<int>()) {
+    return false;
+  }
+#endif
+};
+
+#endif
@@ -0,0 +1,174 @@
+// Transpose.h
+
+#ifndef TRANSPOSE_H
+
+#define TRANSPOSE_H
+
+#include "CyclBuf.h"
+#include <cstdint>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Blocked transposes between the interleaved layout in which salpa
+   reads and writes files (one scan of STRIDE samples after another)
+   and a channel-major layout (one run of samples per channel, the
+   runs DSTRIDE apart). The work is done in tiles of 8x8 samples, which
+   for 16-bit samples on x86 are transposed in SSE2 registers. The
+   common scan widths (64, 142, and 384 channels) have their own
+   compiled versions, so that all of the address arithmetic is
+   constant.
+*/
+
+constexpr int TRANSPOSEBLOCK = 8;
+
+template <typename T>
+inline void transposetile(T const *src, int sstride, T *dst, int dstride) {
+  // DST[c*DSTRIDE + r] = SRC[r*SSTRIDE + c] for an 8x8 tile.
+  constexpr int B = TRANSPOSEBLOCK;
+  for (int c=0; c<B; c++)
+    for (int r=0; r<B; r++)
+      dst[c*dstride + r] = src[r*sstride + c];
+}
+
+#if defined(__SSE2__)
+inline void transposetile(std::int16_t const *src, int sstride,
+                          std::int16_t *dst, int dstride) {
+  // Three rounds of interleaving: 16-, 32-, and 64-bit.
+  __m128i r0 = _mm_loadu_si128((__m128i const *)(src + 0*sstride));
+  __m128i r1 = _mm_loadu_si128((__m128i const *)(src + 1*sstride));
+  __m128i r2 = _mm_loadu_si128((__m128i const *)(src + 2*sstride));
+  __m128i r3 = _mm_loadu_si128((__m128i const *)(src + 3*sstride));
+  __m128i r4 = _mm_loadu_si128((__m128i const *)(src + 4*sstride));
+  __m128i r5 = _mm_loadu_si128((__m128i const *)(src + 5*sstride));
+  __m128i r6 = _mm_loadu_si128((__m128i const *)(src + 6*sstride));
+  __m128i r7 = _mm_loadu_si128((__m128i const *)(src + 7*sstride));
+  __m128i a0 = _mm_unpacklo_epi16(r0, r1);
+  __m128i a1 = _mm_unpackhi_epi16(r0, r1);
+  __m128i a2 = _mm_unpacklo_epi16(r2, r3);
+  __m128i a3 = _mm_unpackhi_epi16(r2, r3);
+  __m128i a4 = _mm_unpacklo_epi16(r4, r5);
+  __m128i a5 = _mm_unpackhi_epi16(r4, r5);
+  __m128i a6 = _mm_unpacklo_epi16(r6, r7);
+  __m128i a7 = _mm_unpackhi_epi16(r6, r7);
+  __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+  _mm_storeu_si128((__m128i *)(dst + 0*dstride), _mm_unpacklo_epi64(b0, b4));
+  _mm_storeu_si128((__m128i *)(dst + 1*dstride), _mm_unpackhi_epi64(b0, b4));
+  _mm_storeu_si128((__m128i *)(dst + 2*dstride), _mm_unpacklo_epi64(b1, b5));
+  _mm_storeu_si128((__m128i *)(dst + 3*dstride), _mm_unpackhi_epi64(b1, b5));
+  _mm_storeu_si128((__m128i *)(dst + 4*dstride), _mm_unpacklo_epi64(b2, b6));
+  _mm_storeu_si128((__m128i *)(dst + 5*dstride), _mm_unpackhi_epi64(b2, b6));
+  _mm_storeu_si128((__m128i *)(dst + 6*dstride), _mm_unpacklo_epi64(b3, b7));
+  _mm_storeu_si128((__m128i *)(dst + 7*dstride), _mm_unpackhi_epi64(b3, b7));
+}
+#endif
+
+template <typename T, int Stride>
+void tochannelswith(T const *src, int stride0, T *dst, int dstride,
+                    int nrows, int nchans) {
+  // DST[c*DSTRIDE + r] = SRC[r*STRIDE + c] for r<NROWS and c<NCHANS.
+  constexpr int B = TRANSPOSEBLOCK;
+  CyclStride<Stride> stride(stride0);
+  int r0 = 0;
+  for (; r0+B<=nrows; r0+=B) {
+    int c0 = 0;
+    for (; c0+B<=nchans; c0+=B)
+      transposetile(src + r0*stride + c0, stride, dst + c0*dstride + r0, dstride);
+    for (int c=c0; c<nchans; c++)
+      for (int r=0; r<B; r++)
+        dst[c*dstride + r0 + r] = src[(r0+r)*stride + c];
+  }
+  for (int r=r0; r<nrows; r++)
+    for (int c=0; c<nchans; c++)
+      dst[c*dstride + r] = src[r*stride + c];
+}
+
+template <typename T, int Stride>
+void toscanswith(T const *src, int sstride, T *dst, int stride0,
+                 int nrows, int nchans) {
+  // DST[r*STRIDE + c] = SRC[c*SSTRIDE + r] for r<NROWS and c<NCHANS.
+  constexpr int B = TRANSPOSEBLOCK;
+  CyclStride<Stride> stride(stride0);
+  int r0 = 0;
+  for (; r0+B<=nrows; r0+=B) {
+    int c0 = 0;
+    for (; c0+B<=nchans; c0+=B)
+      transposetile(src + c0*sstride + r0, sstride, dst + r0*stride + c0, stride);
+    for (int r=0; r<B; r++)
+      for (int c=c0; c<nchans; c++)
+        dst[(r0+r)*stride + c] = src[c*sstride + r0 + r];
+  }
+  for (int r=r0; r<nrows; r++)
+    for (int c=0; c<nchans; c++)
+      dst[r*stride + c] = src[c*sstride + r];
+}
+
+template <typename T>
+void tochannels(CyclBuf<T> const &scans, CyclBuf<T> &chans,
+                int nchans, int chanstride,
+                std::uint64_t t0, std::uint64_t t1) {
+  /* Copies the first NCHANS channels of scans T0 up to T1 from the
+     interleaved buffer SCANS (which addresses the first channel of
+     each scan) to CHANS, in which the ring for channel c starts
+     c*CHANSTRIDE elements from the first. All rings must be of the
+     same size.
+  */
+  while (t0 < t1) {
+    int count = t1 - t0 < std::uint64_t(scans.size()) ? t1 - t0 : scans.size();
+    count = scans.contiguous(t0, count);
+    count = chans.contiguous(t0, count);
+    T const *src = &scans[t0];
+    T *dst = &chans[t0];
+    switch (scans.step()) {
+    case 64:
+      tochannelswith<T, 64>(src, 64, dst, chanstride, count, nchans);
+      break;
+    case 142:
+      tochannelswith<T, 142>(src, 142, dst, chanstride, count, nchans);
+      break;
+    case 384:
+      tochannelswith<T, 384>(src, 384, dst, chanstride, count, nchans);
+      break;
+    default:
+      tochannelswith<T, 0>(src, scans.step(), dst, chanstride, count, nchans);
+    }
+    t0 += count;
+  }
+}
+
+template <typename T>
+void toscans(CyclBuf<T> const &chans, CyclBuf<T> &scans,
+             int nchans, int chanstride,
+             std::uint64_t t0, std::uint64_t t1) {
+  // The inverse of tochannels.
+  while (t0 < t1) {
+    int count = t1 - t0 < std::uint64_t(scans.size()) ? t1 - t0 : scans.size();
+    count = scans.contiguous(t0, count);
+    count = chans.contiguous(t0, count);
+    T const *src = &chans[t0];
+    T *dst = &scans[t0];
+    switch (scans.step()) {
+    case 64:
+      toscanswith<T, 64>(src, chanstride, dst, 64, count, nchans);
+      break;
+    case 142:
+      toscanswith<T, 142>(src, chanstride, dst, 142, count, nchans);
+      break;
+    case 384:
+      toscanswith<T, 384>(src, chanstride, dst, 384, count, nchans);
+      break;
+    default:
+      toscanswith<T, 0>(src, chanstride, dst, scans.step(), count, nchans);
+    }
+    t0 += count;
+  }
+}
+
+#endif
@@ -0,0 +1,197 @@
+// WorkerPool.h
+
+#ifndef WORKERPOOL_H
+
+#define WORKERPOOL_H
+
+/* A WorkerPool keeps a fixed set of threads that all run the same job,
+   each with its own index, every time START is called. Typically,
+   the job uses the index to pick channels from a WorkSplit (below), so
+   the work a thread does is mostly the same from one step to the
+   next.
+
+   Unlike TaskQueue, nothing is allocated or queued per step: START
+   publishes a pointer to the job and bumps a generation counter, and
+   WAIT returns once all workers have finished. Both sides spin for a
+   little while before they go to sleep on a futex, because the steps
+   between stimuli can be so short that a trip through the scheduler
+   costs as much as the work itself (see Doorbell.h). Spinning is
+   skipped if there are not enough CPUs to go around.
+*/
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include "Placement.h"
+#include "Doorbell.h"
+
+class WorkerPool {
+public:
+  static constexpr int SPINS = 20000; // roughly tens of microseconds
+public:
+  WorkerPool(int n, std::vector<int> const &cpus=std::vector<int>()):
+    fn(0), arg(0), gen(0), pending(0), sleepers(0), waiting(0),
+    quit(false) {
+    if (n<1)
+      n = 1;
+    spins = n < int(std::thread::hardware_concurrency()) ? SPINS : 0;
+    for (int k=0; k<n; k++)
+      thrs.push_back(std::thread(&WorkerPool::worker, this, k,
+                                 k<int(cpus.size()) ? cpus[k] : -1));
+  }
+  ~WorkerPool() {
+    quit = true;
+    publish();
+    for (auto &t: thrs)
+      t.join();
+  }
+  WorkerPool(WorkerPool const &) = delete;
+  WorkerPool &operator=(WorkerPool const &) = delete;
+  int size() const {
+    return thrs.size();
+  }
+  template <class F> void start(F const &job) {
+    /* Runs JOB(k) on each worker k. JOB must stay alive until WAIT
+       returns. Must not be called again before WAIT.
+    */
+    fn = &call<F>;
+    arg = &job;
+    pending.store(thrs.size());
+    publish();
+  }
+  void wait() {
+    // Returns once every worker has finished the job given to START.
+    int left = pending.load();
+    for (int k=0; k<spins && left; k++) {
+      cpupause();
+      left = pending.load();
+    }
+    while (left) {
+      waiting++;
+      if (pending.load())
+        futexwait(pending, left);
+      waiting--;
+      left = pending.load();
+    }
+  }
+  template <class F> void run(F const &job) {
+    start(job);
+    wait();
+  }
+private:
+  template <class F> static void call(void const *job, int k) {
+    (*static_cast<F const *>(job))(k);
+  }
+  void publish() {
+    gen++;
+    if (sleepers.load())
+      futexwake(gen);
+  }
+  void worker(int k, int cpu) {
+    if (cpu>=0)
+      pinthread(cpu);
+    int seen = 0;
+    while (true) {
+      int now = gen.load();
+      for (int i=0; i<spins && now==seen; i++) {
+        cpupause();
+        now = gen.load();
+      }
+      while (now==seen) {
+        sleepers++;
+        if (gen.load()==seen)
+          futexwait(gen, seen);
+        sleepers--;
+        now = gen.load();
+      }
+      seen = now;
+      if (quit)
+        break;
+      fn(arg, k);
+      if (pending.fetch_sub(1)==1 && waiting.load())
+        futexwake(pending);
+    }
+  }
+private:
+  std::vector<std::thread> thrs;
+  void (*fn)(void const *, int);
+  void const *arg;
+  std::atomic<int> gen; // bumped by START
+  std::atomic<int> pending; // workers yet to finish the current job
+  std::atomic<int> sleepers; // workers asleep on GEN
+  std::atomic<int> waiting; // main thread asleep on PENDING
+  std::atomic<bool> quit;
+  int spins;
+};
+
+/* A WorkSplit hands out NCHUNKS chunks of work to the workers of a
+   pool. Each worker starts out with a contiguous range of chunks and
+   takes them from the front. A worker that runs out takes chunks from
+   the back of whichever range has the most left. So when the load is
+   balanced, every worker sticks to its own chunks, step after step,
+   and when it is not, only the tail of a busy range moves. That is
+   what matters for salpa, where a channel that is being re-fitted
+   after an artifact costs far more per sample than one in the OK
+   state or one that is pegged.
+   RESET must be called (from outside the pool) before each step.
+*/
+
+class WorkSplit {
+public:
+  WorkSplit(int nchunks, int nworkers):
+    nchunks(nchunks), nworkers(nworkers), ranges(new Range[nworkers]) {
+    reset();
+  }
+  int first(int k) const {
+    // The first chunk in the range of worker K, or NCHUNKS if K==NWORKERS.
+    return std::int64_t(k)*nchunks/nworkers;
+  }
+  void reset() {
+    for (int k=0; k<nworkers; k++)
+      ranges[k].span.store(pack(first(k), first(k+1)));
+  }
+  int next(int k) {
+    // Returns the next chunk for worker K, or -1 if all are taken.
+    std::atomic<std::uint64_t> &own = ranges[k].span;
+    std::uint64_t s = own.load();
+    while (begin(s) < end(s))
+      if (own.compare_exchange_weak(s, pack(begin(s) + 1, end(s))))
+        return begin(s);
+    while (true) {
+      int victim = -1;
+      std::uint32_t most = 0;
+      for (int j=0; j<nworkers; j++) {
+        std::uint64_t r = ranges[j].span.load();
+        if (end(r) > begin(r) && end(r) - begin(r) > most) {
+          most = end(r) - begin(r);
+          victim = j;
+        }
+      }
+      if (victim<0)
+        return -1;
+      std::atomic<std::uint64_t> &other = ranges[victim].span;
+      s = other.load();
+      if (begin(s) < end(s)
+          && other.compare_exchange_strong(s, pack(begin(s), end(s) - 1)))
+        return end(s) - 1;
+    }
+  }
+private:
+  static std::uint64_t pack(std::uint32_t b, std::uint32_t e) {
+    return (std::uint64_t(b)<<32) | e;
+  }
+  static std::uint32_t begin(std::uint64_t s) { return s>>32; }
+  static std::uint32_t end(std::uint64_t s) { return std::uint32_t(s); }
+private:
+  struct Range {
+    std::atomic<std::uint64_t> span; // first and last+1 chunk not yet taken
+    char pad[64 - sizeof(std::atomic<std::uint64_t>)]; // own cache line
+  };
+  int nchunks;
+  int nworkers;
+  std::unique_ptr<Range[]> ranges;
+};
+
+#endif
@@ -1,14 +1,29 @@
 // posthocsalpa.cpp
 
-#include "LocalFit.h"
+#include "LocalFitBank.h"
 #include "NoiseLevels.h"
+#include "Trace.h"
+#include "EventDetector.h"
+#include "Transpose.h"
+#include "ChannelMap.h"
+#include "DeadChannels.h"
 #include <iostream>
 #include <vector>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <cstdint>
-#include "TaskQueue.h"
+#include <cmath>
+#include <string>
+#include <sstream>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include "WorkerPool.h"
+#include "Stages.h"
+#include "Placement.h"
+#include "Shards.h"
+#include "MappedFile.h"
 
 /* Number of threads is experimentally determined for each computer.
    Ditto for bufsize. On my home laptop, 12 is the best number,
@@ -21,16 +36,21 @@ void usage() {
   std::cerr
     << "Usage: salpa -F samplerate_kHz -c channelcount -C fullcount\n"
     << "             -t threshold_digi -x threshold_std\n"
-    << "             -l halflength_ms\n"
+    << "             -l halflength_ms -O order\n"
     << "             -a asymtime_ms -b blanktime_ms -A Ahead_ms\n"
     << "             -r rail1_digi[,rail2_digi]\n"
     << "             -p period_ms -d delay_ms -f forcepeg_ms\n"
     << "             -P forcepeg_filename\n"
+    << "             -E trigger_channel,trigger_digi -K railcount,window_ms\n"
     << "             -T thread_count -S buffer_size\n"
     << "             -i input_file -o output_file\n"
     << "             -M skip_count -N limit_count\n"
-    << "             -B\n"
+    << "             -Q qc_file -D trace_file -m channel_map -V dead_range\n"
+    << "             -J segment_count -W warmup_ms -I from,to\n"
+    << "             -B -X -H -R\n"
     << "             -Z\n"
+    << "   or: salpa plan -G group_count -J segment_count [options as above]\n"
+    << "   or: salpa merge plan_file\n"
     << "\n"
     << "Performs post-hoc artifact filtering using LocalFit.\n"
     << "-F must be given before any of the parameters that are specified in ms\n"
@@ -38,12 +58,18 @@ void usage() {
     << "   channels in a scan. (For instance, for a UCLA probe, -c might be 128\n"
     << "   whereas -C might be 142.) If only one of -c or -C is given, the\n"
     << "   other is assumed to be the same.\n"
+    << "-m specifies which of the -C channels to fit (f), pass through (p), or\n"
+    << "   drop from the output (d), as a list like \"0-59:f,60-63:p,64-65:d\",\n"
+    << "   or the name of a file containing such a list. Unlisted channels are\n"
+    << "   passed through. -m and -c are mutually exclusive.\n"
     << "-t specifies acceptability threshold as an absolute digital value.\n"
     << "-x specifies acceptability threshold as a multiple of estimated\n"
     << "   RMS noise. (The estimate is made using the first part of the\n"
     << "   recording.)\n"
     << "-t and -x are mutually exclusive.\n"
     << "-l specifies the half-width of the fit window (tau).\n"
+    << "-O specifies the order of the fitted polynomial: 0 (constant), 1 (linear),\n"
+    << "   2 (quadratic), or 3 (cubic). Lower orders are cheaper.\n"
     << "-a specifies the size of the beginning of the fit window used for initial\n"
     << "   goodness-of-fit estimation.\n"
     << "-b specifies how much of the first fit is blanked.\n"
@@ -58,32 +84,84 @@ void usage() {
     << "   and the second number is the corresponding forcepeg sample count,\n"
     << "   which overrides the value passed through -f.\n"
     << "   -P and -p/-d are mutually exclusive.\n"
+    << "-E forces a peg response whenever the given channel (counting from zero,\n"
+    << "   and typically one of the auxiliary channels) crosses the given value:\n"
+    << "   upward if positive, downward if negative.\n"
+    << "-K forces a peg response when at least the given number of channels hit\n"
+    << "   the rail within the given window. The response starts at the first\n"
+    << "   of those hits (but no more than one window earlier than the last).\n"
+    << "   -E and -K detect events in the same pass as the filtering. They are\n"
+    << "   mutually exclusive with each other and with -P and -p/-d. The duration\n"
+    << "   of the response is given by -f.\n"
     << "-T specifies thread count.\n"
     << "-S specifies buffer size in scans; rounded down to power of two.\n"
     << "-i and -o specify input and output filenames. If not given, \n"
     << "   stdin/stdout are used, which does not work right on Windows.\n"
     << "-M skip given number of scans from the beginning of the file.\n"
     << "-N process only the given number of scans.\n"
+    << "-J splits the recording into the given number of segments in time,\n"
+    << "   which are processed at the same time, each with its share of the\n"
+    << "   threads. Requires -i and -o. Each segment starts early, by the\n"
+    << "   warm-up time given with -W, to get LocalFit into the same state as\n"
+    << "   in a single pass. Channels that are in the midst of an artifact at\n"
+    << "   a boundary between segments may come out differently there; salpa\n"
+    << "   reports how many there were. So may dead channels (see -V).\n"
+    << "   With -J, -N is exact.\n"
+    << "-I processes only scans FROM up to TO (counting after -M), with\n"
+    << "   warm-up as for -J, and writes out only those. Requires -i and -o.\n"
+    << "-Q specifies where to write a JSON summary of per-channel counters: time\n"
+    << "   spent in each state, number of pegs, blanked samples, RMS before and\n"
+    << "   after filtering, etc. By default, that is the output filename with\n"
+    << "   \".qc.json\" appended, or nowhere if the output is stdout.\n"
+    << "-D saves a trace of state transitions to the given file, for\n"
+    << "   conversion to CSV by salpa-trace. Only available if salpa was\n"
+    << "   built with SALPA_TRACE.\n"
+    << "-V specifies the range (max - min, in digital units) within which a\n"
+    << "   channel must stay for a second to be considered dead. Dead channels\n"
+    << "   are not fitted; their output is zero. They come back to life as soon\n"
+    << "   as they leave that range. A negative value disables this.\n"
+    << "   With -J or -I, each segment judges channels on its own data, so a\n"
+    << "   channel may be found dead (or alive) at a different time than in\n"
+    << "   a single pass, and come out differently for that time, even away\n"
+    << "   from artifacts. A longer -W makes this rarer.\n"
     << "-B enables subtracting of baseline before processing. This is useful\n"
     << "   for numerical stability if baseline is far from zero.\n"
+    << "-X makes LocalFit work on channel-major copies of the data, which are\n"
+    << "   transposed in and out in blocks. This may be faster for large channel\n"
+    << "   counts, where the interleaved layout wastes memory bandwidth.\n"
+    << "-H pins worker threads to CPUs spread over the NUMA nodes, and puts the\n"
+    << "   sample buffers in huge pages first touched by the threads that use\n"
+    << "   them. For multi-socket machines; Linux only.\n"
+    << "-R maps the input file (-i) into memory instead of reading it into a\n"
+    << "   ring buffer, which saves a copy of every sample. Not when -m drops\n"
+    << "   channels. Where mapping is not possible, salpa reads instead.\n"
     << "-Z specifies that “blank depeg” (-b) is not to be aborted at zero crossing.\n" 
     << "\n"
+    << "salpa plan writes a shell script to stdout that runs salpa on shards\n"
+    << "of the recording: -G groups of fitted channels by -J stretches of\n"
+    << "time (with -I), each with an output file of its own. The shards may\n"
+    << "run in any order, as separate jobs. Afterwards, salpa merge with that\n"
+    << "script as its argument puts together the output named by -o.\n"
+    << "\n"
     << "Default values are:\n"
     << "   F = 30,000, c = C = 64, l = 3 ms,\n"
-    << "   a = 0.2 ms, b = 0.4 ms, A = 0.2 ms, x = 3,\n"
+    << "   a = 0.2 ms, b = 0.4 ms, A = 0.2 ms, x = 3, O = 3,\n"
     << "   r = -32767,32767, no forced peg response,\n"
-    << "   T = 8, S = 4096\n";
+    << "   T = 8, S = 4096, V = 0, J = 1, W = 1000 ms\n";
 exit(1);
 }
 
 class Params {
 public:
-  int nchans;
-  int totalchans;
+  int nchans; // after FROMARGS, the number of channels fitted
+  int totalchans; // after FROMARGS, the number of channels kept
+  char const *chanmap_spec;
+  ChannelMap chanmap;
   int freq_hz;
   int thresh_digi;
   float thresh_std;
   int tau_sams;
+  int order;
   int asym_sams;
   int blank_sams;
   int ahead_sams;
@@ -92,11 +170,25 @@ public:
   int delay_sams;
   int forcepeg_sams;
   char const *forcepeg_filename;
+  int trigger_chan;
+  raw_t trigger_digi;
+  int consensus_count;
+  int consensus_sams;
+  int deadrange;
   bool basesub;
+  bool chanmajor;
+  bool placement;
+  bool mapinput;
   int nthreads;
+  int nsegments;
+  int warmup_sams;
+  int ngroups; // for salpa plan
+  std::uint64_t interval_from, interval_to;
   int log2bufsize;
   char const *input_filename;
   char const *output_filename;
+  char const *qc_filename;
+  char const *trace_filename;
   bool usenegv;
   std::uint64_t skip_count;
   std::uint64_t limit_count;
@@ -105,7 +197,14 @@ public:
     usenegv = true;
     input_filename = 0;
     output_filename = 0;
+    qc_filename = 0;
+    trace_filename = 0;
+    chanmap_spec = 0;
     nthreads = 8;
+    nsegments = 1;
+    warmup_sams = -1; // i.e., one second
+    ngroups = 1;
+    interval_from = interval_to = 0; // i.e., everything
     log2bufsize = 12;
     nchans = 0;
     totalchans = 0;
@@ -113,6 +212,7 @@ public:
     thresh_digi = 0; // i.e., do not use
     thresh_std = 3;
     tau_sams = 3 * freq_hz / 1000; // 3 ms
+    order = LocalFitBank::MAXORDER;
     asym_sams = 10;
     blank_sams = 20;
     ahead_sams = 5;
@@ -122,7 +222,15 @@ public:
     delay_sams = 0;
     forcepeg_sams = 0;
     forcepeg_filename = 0;
+    trigger_chan = -1;
+    trigger_digi = 0;
+    consensus_count = 0;
+    consensus_sams = 0;
+    deadrange = 0; // i.e., only flat channels
     basesub = false;
+    chanmajor = false;
+    placement = false;
+    mapinput = false;
     skip_count = 0;
     limit_count = 0;
   }
@@ -134,7 +242,8 @@ public:
       if (argv[0][0]=='-') {
         char letter = argv[0][1];
         char *arg;
-        if (argv[0][2]>=32 || letter=='B' || letter=='Z') {
+        if (argv[0][2]>=32 || letter=='B' || letter=='Z'
+            || letter=='X' || letter=='H' || letter=='R') {
           arg = argv[0] + 2;
         } else {
           argc--;
@@ -153,6 +262,7 @@ public:
         case 'x': thresh_std = atof(arg); thresh_digi = 0; break;
         case 'F': freq_hz = int(1000*atof(arg)); break;
         case 'l': tau_sams = int(freq_hz * atof(arg) / 1000); break;
+        case 'O': order = atoi(arg); break;
         case 'a': asym_sams = int(freq_hz * atof(arg) / 1000); break;
         case 'b': blank_sams = int(freq_hz * atof(arg) / 1000); break;
         case 'A': ahead_sams = int(freq_hz * atof(arg) / 1000); break;
@@ -166,7 +276,24 @@ public:
         case 'd': delay_sams = int(freq_hz * atof(arg) / 1000); break;
         case 'f': forcepeg_sams = int(freq_hz * atof(arg) / 1000); break;
         case 'P': forcepeg_filename = arg; break;
+        case 'E': {
+          trigger_chan = atoi(arg);
+          char *x = std::strchr(arg, ',');
+          if (!x)
+            return false;
+          trigger_digi = atoi(x+1);
+        } break;
+        case 'K': {
+          consensus_count = atoi(arg);
+          char *x = std::strchr(arg, ',');
+          if (!x)
+            return false;
+          consensus_sams = int(freq_hz * atof(x+1) / 1000);
+        } break;
         case 'B': basesub = true; break;
+        case 'X': chanmajor = true; break;
+        case 'H': placement = true; break;
+        case 'R': mapinput = true; break;
         case 'Z': usenegv = false; break;
         case 'T': nthreads = atoi(arg); break;
         case 'S': log2bufsize = int(log(atoi(arg)) / log(2)); break;
@@ -174,6 +301,20 @@ public:
         case 'o': output_filename = arg; break;
         case 'M': skip_count = atol(arg); break;
         case 'N': limit_count = atol(arg); break;
+        case 'Q': qc_filename = arg; break;
+        case 'D': trace_filename = arg; break;
+        case 'm': chanmap_spec = arg; break;
+        case 'V': deadrange = atoi(arg); break;
+        case 'J': nsegments = atoi(arg); break;
+        case 'W': warmup_sams = int(freq_hz * atof(arg) / 1000); break;
+        case 'G': ngroups = atoi(arg); break;
+        case 'I': {
+          interval_from = atol(arg);
+          char *x = std::strchr(arg, ',');
+          if (!x)
+            return false;
+          interval_to = atol(x+1);
+        } break;
         default:
           std::cerr << "Unknown parameter: " << letter << "\n";
           return false;
@@ -183,6 +324,8 @@ public:
         return false;
       }
     }
+    if (chanmap_spec && nchans)
+      return false;
     if (nchans==0)
       nchans = totalchans;
     else if (totalchans==0)
@@ -191,8 +334,64 @@ public:
       nchans = totalchans = 64;
     if (nchans>totalchans)
       return false;
+    if (chanmap_spec) {
+      if (!chanmap.parse(chanmap_spec, totalchans))
+        return false;
+    } else {
+      chanmap = ChannelMap(nchans, totalchans);
+    }
+    if (trigger_chan>=totalchans)
+      return false;
+    if (trigger_chan>=0) {
+      trigger_chan = chanmap.slot(trigger_chan);
+      if (trigger_chan<0) {
+        std::cerr << "The trigger channel cannot be dropped\n";
+        return false;
+      }
+    }
+    // From here on, channels are counted in slots (see ChannelMap.h).
+    nchans = chanmap.fitcount();
+    totalchans = chanmap.keepcount();
     if (blank_sams > tau_sams)
       return false;
+    if (order<0 || order>LocalFitBank::MAXORDER)
+      return false;
+    int eventsources = (forcepeg_filename!=0) + (period_sams!=0)
+      + (trigger_chan>=0) + (consensus_count>0);
+    if (eventsources>1)
+      return false;
+    if (consensus_count>nchans || (consensus_count>0 && consensus_sams<1))
+      return false;
+    if (trace_filename && !Trace::enabled) {
+      std::cerr << "This salpa was built without SALPA_TRACE\n";
+      return false;
+    }
+    if (warmup_sams<0)
+      warmup_sams = freq_hz;
+    if (nsegments<1)
+      return false;
+    if (nsegments>1 && (!input_filename || !output_filename)) {
+      std::cerr << "Segments (-J) need named input and output files\n";
+      return false;
+    }
+    if (nsegments>1 && trace_filename) {
+      std::cerr << "Segments (-J) cannot be traced\n";
+      return false;
+    }
+    if (interval_to>0) {
+      if (interval_to<=interval_from || nsegments>1)
+        return false;
+      if (!input_filename || !output_filename) {
+        std::cerr << "Intervals (-I) need named input and output files\n";
+        return false;
+      }
+    }
+    if (ngroups<1 || ngroups>nchans)
+      return false;
+    if (mapinput && (!input_filename || !chanmap.identity())) {
+      std::cerr << "Mapped input (-R) needs -i, and cannot drop channels\n";
+      return false;
+    }
     return true;
   }
 };
@@ -202,34 +401,142 @@ void crash(char const *x) {
   std::exit(2);
 }
 
-int main(int argc, char **argv) {
-  if ((INFTY + 1) != 0) {
-    crash("BUG: Infinity isn't.");
-    return 2;
+void touchblocks(WorkerPool &pool, raw_t *data,
+                 std::vector<std::size_t> const &edges) {
+  /* Zeroes DATA[EDGES[k]] up to DATA[EDGES[k+1]] on worker k, so that
+     with -H, those pages are placed on the NUMA node of that worker.
+  */
+  int nblocks = edges.size() - 1;
+  pool.run([&](int k) {
+    if (k<nblocks)
+      std::fill(data + edges[k], data + edges[k+1], raw_t(0));
+  });
+}
+
+void copyrows(CyclBuf<raw_t> const &src, CyclBuf<raw_t> &dst,
+              timeref_t t0, timeref_t t1, int c0, int c1) {
+  /* Copies channels C0 up to C1 of scans T0 up to T1. SRC and DST must
+     address the first channel of interleaved buffers of the same shape.
+  */
+  while (t0 < t1) {
+    int count = t1 - t0 < timeref_t(src.size()) ? t1 - t0 : src.size();
+    count = src.contiguous(t0, count);
+    count = dst.contiguous(t0, count);
+    raw_t const *x = &src[t0];
+    raw_t *y = &dst[t0];
+    for (int k=0; k<count; k++) {
+      for (int c=c0; c<c1; c++)
+        y[c] = x[c];
+      x += src.step();
+      y += dst.step();
+    }
+    t0 += count;
   }
-  Params p;
-  if (!p.fromArgs(argc, argv)) {
-    usage();
-    return 1;
+}
+
+void writeqc(char const *fn, std::vector<LocalFitBank::Stats> const &stats,
+             ChannelMap const &map,
+             std::vector<float> const &thresh, timeref_t nsams) {
+  /* Writes per-channel counters as JSON. RMS values are taken over the
+     samples that were in state OK. Channels are numbered as in the
+     input file.
+  */
+  FILE *fd = std::fopen(fn, "w");
+  if (!fd)
+    crash("Cannot open QC file");
+  std::fprintf(fd, "{\n  \"samples\": %llu,\n  \"channels\": [",
+               (unsigned long long)nsams);
+  for (int c=0; c<int(stats.size()); c++) {
+    LocalFitBank::Stats const &st = stats[c];
+    std::fprintf(fd, "%s\n    {\"channel\": %i, \"threshold\": %g,",
+                 c ? "," : "", map.filechannel(c), thresh[c]);
+    std::fprintf(fd, "\n     \"states\": {");
+    for (int s=0; s<LocalFitBank::NSTATES; s++)
+      std::fprintf(fd, "%s\"%s\": %llu", s ? ", " : "",
+                   LocalFitBank::stateName(LocalFitBank::State(s)),
+                   (unsigned long long)st.samples[s]);
+    timeref_t n_ok = st.samples[int(LocalFitBank::State::OK)];
+    std::fprintf(fd, "},\n     \"pegs\": %llu, \"forcepegs\": %llu,"
+                 " \"retries\": %llu, \"blanked\": %llu,",
+                 (unsigned long long)st.pegs,
+                 (unsigned long long)st.forcepegs,
+                 (unsigned long long)st.retries,
+                 (unsigned long long)st.blanked);
+    std::fprintf(fd, "\n     \"rms_in\": %g, \"rms_out\": %g}",
+                 n_ok ? std::sqrt(st.sumsq_in / n_ok) : 0.0,
+                 n_ok ? std::sqrt(st.sumsq_out / n_ok) : 0.0);
   }
+  std::fprintf(fd, "\n  ]\n}\n");
+  if (std::fclose(fd) != 0)
+    crash("Cannot write QC file");
+}
 
-  if (p.thresh_digi!=0 && p.thresh_std!=0) {
-    usage();
-    return 1;
+bool seekahead(FILE *f, std::uint64_t bytes) {
+  // Moves BYTES ahead in F, no more than a gigabyte at a time.
+  while (bytes>0) {
+    std::uint64_t now = bytes;
+    if (now>1024*1024*1024)
+      now = 1024*1024*1024;
+    if (fseek(f, now, SEEK_CUR) != 0)
+      return false;
+    bytes -= now;
   }
+  return true;
+}
 
-  FILE *in = p.input_filename
-    ? std::fopen(p.input_filename, "rb")
-    : std::freopen(0, "rb", stdin);
-  if (!in)
-    crash("Cannot open input file");
+struct Segment {
+  /* A stretch of the recording that is processed in one go, in scans
+     counted from the first one after -M. Scans START up to END are
+     processed (END may be INFTY, i.e., the end of the file), but only
+     FROM up to TO are written out. The rest is warm-up, during which
+     the fitters settle into the state they would have had in a single
+     pass. Without -J, the whole recording is one segment.
+  */
+  timeref_t start, end;
+  timeref_t from, to;
+};
 
-  FILE *out = p.output_filename
-    ? std::fopen(p.output_filename, "wb")
-    : std::freopen(0, "wb", stdout);
-  if (!out)
-    crash("Cannot open output file");
+struct Outcome {
+  /* What RUNSEGMENT found: the states and counters of all channels as
+     processing passed FROM and TO, or stopped short of them at the end
+     of the data or at -N. A forced peg may run across FROM or TO, in
+     which case the snapshot is taken at its end and is not EXACT.
+  */
+  struct Snapshot {
+    timeref_t t;
+    bool exact;
+    std::vector<LocalFitBank::State> states;
+    std::vector<LocalFitBank::Stats> stats;
+  };
+  Snapshot atfrom, atto;
+  std::vector<char> everdead;
+};
+
+Segment segment(timeref_t from, timeref_t to, timeref_t warmup,
+                int fragsams) {
+  /* The segment that writes out scans FROM up to TO, with WARMUP scans
+     on either side. It starts on a fragment boundary, so that LocalFit
+     gets called exactly as in a single pass.
+  */
+  Segment seg;
+  seg.from = from;
+  seg.to = to;
+  seg.start = from > warmup ? (from - warmup) & ~timeref_t(fragsams-1) : 0;
+  seg.end = to + warmup;
+  return seg;
+}
 
+void runsegment(Params const &p, Segment const &seg, FILE *in, FILE *out,
+                std::vector<raw_t> const &head, int nhead,
+                std::vector<float> const &thresh,
+                std::vector<raw_t> const &basesub,
+                int nthreads, std::vector<int> const &cpus, bool chatty,
+                Outcome &res) {
+  /* Runs LocalFit over segment SEG. IN must be positioned at scan
+     SEG.START + NHEAD and OUT at scan SEG.FROM. The first NHEAD scans
+     of the segment are taken from HEAD, which holds them in salpa's
+     own layout. Progress is reported only if CHATTY.
+  */
   FILE *events = p.forcepeg_filename
     ? std::fopen(p.forcepeg_filename, "r")
     : 0;
@@ -237,48 +544,125 @@ int main(int argc, char **argv) {
     crash("Cannot open timestamp file");
 
   char linebuf[100];
-  std::uint64_t skip = p.skip_count;
-  skip *= sizeof(raw_t);
-  skip *= p.totalchans;
-  std::cerr << "SALPA says hello\n" << "skip = " << skip << " " << sizeof(skip) << "\n";
- 
-  while (skip>0) {
-      std::cerr << "SALPA left to skip " << skip <<"\n";
-      std::uint64_t skipnow = skip;
-      if (skipnow>1024*1024*1024)
-          skipnow = 1024*1024*1024;
-      //std::cerr << "skipping now " << skipnow << "\n";
-      if (fseek(in, skipnow, SEEK_CUR) != 0) {
-          std::cerr << "FSEEK FAILED: " << strerror(errno) << "\n";
-          return 2;
-      }
-      skip -= skipnow;
-  }
+  const timeref_t origin = p.skip_count + seg.start; // in the file
+  // From here on, time is counted from SEG.START.
+  const timeref_t from = seg.from - seg.start;
+  const timeref_t to = seg.to==INFTY ? INFTY : seg.to - seg.start;
+  const timeref_t end = seg.end==INFTY ? INFTY : seg.end - seg.start;
 
   const int BUFSAMS = 1<<p.log2bufsize;
   const int FRAGSAMS = BUFSAMS / 4;
   const int FRAGMASK = FRAGSAMS - 1;
-  
-  std::vector<raw_t> inbuf(p.totalchans*BUFSAMS);
-  std::vector<raw_t> outbuf(p.totalchans*BUFSAMS);  
+
+  /* Channels are handed to the threads in chunks (see WorkSplit). A
+     chunk is one group of lanes for the lockstep kernel if there are
+     enough channels to go around; otherwise, smaller chunks keep all
+     threads busy and give room for rebalancing.
+  */
+  int chunk = LocalFitBank::LANES;
+  if (p.chanmajor || p.nchans < chunk*nthreads) {
+    chunk = p.nchans / (2*nthreads);
+    if (chunk<1)
+      chunk = 1;
+  }
+  int nchunks = (p.nchans + chunk - 1) / chunk;
+  WorkSplit split(nchunks, nthreads);
+  WorkerPool pool(nthreads, cpus);
+
+  /* With -R, the input is used where it lies, in a mapping of the
+     file, through a ring that is large enough never to wrap within
+     the segment. CyclBuf cannot address more than 2^30 scans that
+     way; longer segments are read as usual.
+  */
+  const std::uint64_t rowbytes = sizeof(raw_t)*p.totalchans;
+  std::unique_ptr<MappedFile> mapped;
+  timeref_t mappedto = 0; // scans in the mapping
+  int maplog2 = 0;
+  if (p.mapinput) {
+    mapped.reset(new MappedFile(p.input_filename, origin*rowbytes,
+                                end==INFTY ? ~std::uint64_t(0)
+                                : end*rowbytes, BUFSAMS*rowbytes));
+    mappedto = mapped->size() / rowbytes;
+    while (maplog2<30 && (timeref_t(1)<<maplog2) < mappedto + BUFSAMS)
+      maplog2++;
+    if (!mapped->ok() || (timeref_t(1)<<maplog2) < mappedto + BUFSAMS) {
+      if (chatty)
+        std::cerr << "salpa cannot map the input; reading it instead\n";
+      mapped.reset();
+    }
+  }
+
+  // The interleaved buffers are mirrored where possible, so that
+  // reads and writes never have to be split at the wrap point.
+  BigBuf<raw_t> inbuf(mapped ? 0 : p.totalchans*BUFSAMS, p.placement, true);
+  BigBuf<raw_t> outbuf(p.totalchans*BUFSAMS, p.placement, true);
   std::vector<CyclBuf<raw_t>> inbufs;
   std::vector<CyclBuf<raw_t>> outbufs;
   for (int c=0; c<p.totalchans; c++) {
-    inbufs.push_back(CyclBuf<raw_t>(inbuf.data() + c,
-                                    p.log2bufsize, p.totalchans));
+    inbufs.push_back(mapped
+                     ? CyclBuf<raw_t>((raw_t*)mapped->data() + c,
+                                      maplog2, p.totalchans, true)
+                     : CyclBuf<raw_t>(inbuf.data() + c,
+                                      p.log2bufsize, p.totalchans,
+                                      inbuf.mirrored()));
     outbufs.push_back(CyclBuf<raw_t>(outbuf.data() + c,
-                                     p.log2bufsize, p.totalchans));
+                                     p.log2bufsize, p.totalchans,
+                                     outbuf.mirrored()));
+  }
+
+  // With -X, LocalFit works on channel-major copies of the buffers.
+  // The rings are padded by a cache line, so that the transposes do not
+  // keep hitting the same cache sets.
+  const int CHANSTRIDE = BUFSAMS + 32;
+  BigBuf<raw_t> chanin, chanout;
+  if (p.chanmajor) {
+    chanin = BigBuf<raw_t>(p.nchans*CHANSTRIDE, p.placement);
+    chanout = BigBuf<raw_t>(p.nchans*CHANSTRIDE, p.placement);
+  }
+  CyclBuf<raw_t> workin = p.chanmajor
+    ? CyclBuf<raw_t>(chanin.data(), p.log2bufsize) : inbufs[0];
+  CyclBuf<raw_t> workout = p.chanmajor
+    ? CyclBuf<raw_t>(chanout.data(), p.log2bufsize) : outbufs[0];
+
+  if (p.placement) {
+    /* Interleaved rows are shared by all channels, so those buffers
+       can only be spread evenly over the nodes. Channel-major rings
+       (-X) are kept with the worker whose chunks they start out in.
+    */
+    std::vector<std::size_t> rowedges, chanedges;
+    for (int k=0; k<=nthreads; k++) {
+      rowedges.push_back(std::size_t(BUFSAMS)*k/nthreads*p.totalchans);
+      int c = split.first(k)*chunk;
+      chanedges.push_back(std::size_t(c < p.nchans ? c : p.nchans)*CHANSTRIDE);
+    }
+    if (!mapped)
+      touchblocks(pool, inbuf.data(), rowedges);
+    touchblocks(pool, outbuf.data(), rowedges);
+    if (p.chanmajor) {
+      touchblocks(pool, chanin.data(), chanedges);
+      touchblocks(pool, chanout.data(), chanedges);
+    }
   }
 
   timeref_t filledto = 0;
   timeref_t basesubto = 0;
+  timeref_t transposedto = 0; // into workin, with -X
+  timeref_t untransposedto = 0; // out of workout, with -X
   timeref_t processedto = 0;
-  timeref_t savedto = 0;
-  timeref_t nextpeg = p.delay_sams ? p.delay_sams : INFTY;
+  timeref_t savedto = from;
+  timeref_t nextpeg = INFTY;
   timeref_t nextforcepeg_sams = p.forcepeg_sams;
+  if (p.delay_sams) {
+    // The first of the periodic pegs that falls in the segment
+    timeref_t k = 0;
+    if (p.period_sams && seg.start > timeref_t(p.delay_sams))
+      k = (seg.start - p.delay_sams + p.period_sams - 1) / p.period_sams;
+    nextpeg = p.delay_sams + k*p.period_sams - seg.start;
+  }
 
   if (events) {
-    std::cerr << "Salpa running with events\n";
+    if (chatty)
+      std::cerr << "Salpa running with events\n";
     while (true) {
       if (std::fgets(linebuf, 99, events)) {
         linebuf[99] = 0;
@@ -291,137 +675,269 @@ int main(int argc, char **argv) {
         } else {
           nextforcepeg_sams = p.forcepeg_sams;
         }
-        if (nextpeg >= p.skip_count) {
-          nextpeg -= p.skip_count;
-          std::cerr << "nextpeg now positive\n";
+        if (nextpeg >= origin) {
+          nextpeg -= origin;
+          if (chatty)
+            std::cerr << "nextpeg now positive\n";
           break;
         }
       } else {
         nextpeg = INFTY;
-        std::cerr << "nextpeg = infty\n";
+        if (chatty)
+          std::cerr << "nextpeg = infty\n";
         break;
       }
     }
   }
-  
-  std::vector<float> thresh(p.nchans, p.thresh_digi);
-  std::vector<raw_t> basesub(p.nchans, 0);
 
-  if (p.thresh_std!=0 || p.basesub) {
-      std::cerr << "salpa estimating noise\n";
-    int n = std::fread(inbuf.data(),
-                       p.totalchans*sizeof(raw_t), 3*FRAGSAMS,
-                       in);
-    if (n != 3*FRAGSAMS) 
-      crash("Cannot read enough data for noise estimate");
-    filledto = n;
+  if (nhead>0) {
+    if (!mapped)
+      std::copy(head.begin(), head.begin() + std::size_t(nhead)*p.totalchans,
+                inbuf.data());
+    filledto = nhead;
+  }
+
+  LocalFitBank fitters(workin, workout, p.nchans, p.chanmajor ? CHANSTRIDE : 1,
+                       0, p.tau_sams,
+                       p.blank_sams, p.ahead_sams,
+                       p.asym_sams);
+  if (chatty)
+    std::cerr << "rails " << p.rail1 << " and " << p.rail2
+              << " plus " << basesub[0] << "\n";
+  for (int c=0; c<p.nchans; c++) {
+    fitters.setthreshold(c, raw_t(thresh[c])); // whole digital units
+    fitters.setrail(c, p.rail1 + basesub[c], p.rail2 + basesub[c]);
+  }
+  fitters.setusenegv(p.usenegv);
+  fitters.setorder(p.order);
+
+  /* Dead channels are judged first on the data read for the noise
+     estimate, if any, and then every second of the recording. A
+     segment that starts with a warm-up also judges them on all of
+     that, if it lasts a second, once it has been read.
+  */
+  DeadChannels deadchans(p.nchans, p.deadrange, p.freq_hz, seg.start);
+  bool warmedup = from==0;
+  if (p.deadrange>=0) {
+    if (filledto>0) {
+      deadchans.watch(inbufs[0], filledto);
+      deadchans.review(filledto, filledto);
+    }
+    deadchans.apply(fitters, processedto);
+  }
+
+  EventDetector detector;
+  if (p.trigger_chan>=0) {
+    detector.settrigger(p.trigger_chan, p.trigger_digi);
+  } else if (p.consensus_count>0) {
+    std::vector<raw_t> r1(p.nchans), r2(p.nchans);
     for (int c=0; c<p.nchans; c++) {
-      NoiseLevels noise;
-      noise.train(inbufs[c], 0, n);
-      noise.makeready();
-      if (p.thresh_std!=0)
-        thresh[c] = p.thresh_std * noise.std();
-      if (p.basesub)
-        basesub[c] = -noise.mean();
+      r1[c] = p.rail1 + basesub[c];
+      r2[c] = p.rail2 + basesub[c];
     }
+    detector.setconsensus(p.consensus_count, p.consensus_sams, r1, r2);
   }
-  
-  std::vector<LocalFit *> fitters(p.nchans, 0);
-  std::cerr << "rails " << p.rail1 << " and " << p.rail2 << " plus " << basesub[0] << "\n";
-  for (int c=0; c<p.nchans; c++) {
-    fitters[c] = new LocalFit(inbufs[c], outbufs[c],
-                              0, thresh[c], p.tau_sams,
-                              p.blank_sams, p.ahead_sams,
-                              p.asym_sams);
-    fitters[c]->setrail(p.rail1 + basesub[c], p.rail2 + basesub[c]);
-    fitters[c]->setusenegv(p.usenegv);
-    fitters[c]->debug_name = c;
-  }
-  
+
   bool at_eof = false;
   bool go_on = true;
+  bool done = false;
 
   //std::cerr << inbufs[5][13] << "\n";
   //std::cerr << "pre\n" << savedto << " " << processedto << " "
   //          << filledto << " " << nextpeg << " " << events << "\n";
 
-  std::cerr << "salpa ready to go\n";
-  TaskQueue<std::packaged_task<void()>> pool(p.nthreads);
+  if (chatty) {
+    std::cerr << "salpa using " << fitters.accumulator() << " accumulators\n";
+    if (!p.chanmap.identity())
+      std::cerr << "salpa fitting " << p.nchans << " and passing "
+                << p.totalchans - p.nchans << " of "
+                << p.chanmap.filecount() << " channels\n";
+    if (mapped)
+      std::cerr << "salpa using mapped input\n";
+    else if (inbuf.mirrored() && outbuf.mirrored())
+      std::cerr << "salpa using mirrored ring buffers\n";
+    std::cerr << "salpa ready to go\n";
+  }
+
+  /* Reading and writing happen on threads of their own (see Stages.h),
+     which ring BELL whenever there is new data or room for more
+     output. The main loop still takes in one fragment per pass and
+     hands everything before SAVEDTO to the writer, exactly as when it
+     did its own reading and writing, so that LocalFit is called the
+     same way and the output does not depend on timing. The reader
+     keeps HISTORY scans before PROCESSEDTO, because LocalFit looks back
+     that far. Before output is produced in the ring at some time T,
+     MAKEROOM waits for the writer to be done with T - BUFSAMS.
+  */
+  Doorbell bell;
+  std::unique_ptr<ReadStage> reader;
+  if (!mapped)
+    reader.reset(new ReadStage(in, inbufs[0], p.chanmap, FRAGSAMS, filledto,
+                               end, bell));
+  WriteStage writer(out, outbufs[0], p.chanmap, FRAGSAMS, from, bell);
+  const timeref_t HISTORY = 2*p.tau_sams + 2;
+  auto makeroom = [&](timeref_t t) {
+    if (t <= timeref_t(BUFSAMS))
+      return;
+    timeref_t need = t > savedto + BUFSAMS ? savedto : t - BUFSAMS;
+    while (true) {
+      int rung = bell.peek();
+      if (writer.saved() >= need)
+        return;
+      bell.wait(rung);
+    }
+  };
+
+  /* Processing pauses at FROM and TO, so that the state of the fitters
+     there can be noted (see Outcome).
+  */
+  bool pastfrom = false;
+  bool pastto = false;
+  auto snapshot = [&](Outcome::Snapshot &snap, timeref_t mark) {
+    snap.t = processedto;
+    snap.exact = processedto==mark;
+    snap.states.clear();
+    snap.stats.clear();
+    for (int c=0; c<p.nchans; c++) {
+      snap.states.push_back(fitters.stateof(c));
+      snap.stats.push_back(fitters.stats(c));
+    }
+  };
+  auto passmarks = [&]() {
+    if (!pastfrom && processedto >= from) {
+      snapshot(res.atfrom, from);
+      pastfrom = true;
+    }
+    if (!pastto && processedto >= to) {
+      snapshot(res.atto, to);
+      pastto = true;
+    }
+  };
+  passmarks();
+
   timeref_t nexthello = 0;
   while (go_on) {
-      if (processedto >= nexthello) {
+      if (chatty && processedto >= nexthello) {
           std::cerr << "Processed " << processedto << " samples\n";
           nexthello += 100*1000;
       }
     go_on = false;
 
     // -- save some stuff
+    if (p.chanmajor) {
+      toscans(workout, outbufs[0], p.nchans, CHANSTRIDE,
+              untransposedto, processedto);
+      untransposedto = processedto;
+    }
     timeref_t mightsaveto = processedto & ~FRAGMASK;
-    while (savedto < mightsaveto) {
+    if (mightsaveto > to)
+      mightsaveto = to;
+    if (savedto < mightsaveto) {
       go_on = true;
-      fwrite(&(outbufs[0][savedto]),
-             sizeof(raw_t)*p.totalchans, FRAGSAMS,
-             out);
-      savedto += FRAGSAMS;
+      savedto = mightsaveto;
+      writer.publish(savedto);
+    }
+    if (processedto >= to) {
+      writer.finish(to);
+      done = true;
+      break;
+    }
+    if (p.limit_count>0 && savedto >= p.limit_count) {
+      writer.finish(savedto);
+      done = true;
+      break;
     }
-    if (p.limit_count>0 && savedto >= p.limit_count)
-      return 0;
 
     // -- subtract baseline
-    if (p.basesub) {    
-      while (basesubto < filledto) {
-        for (int c=0; c<p.nchans; c++)
-          inbufs[c][basesubto] += basesub[c];
-        basesubto++;
+    if (p.basesub) {
+      CyclBuf<raw_t>::Span rows[2];
+      int n = inbufs[0].spans(basesubto, filledto - basesubto, rows);
+      for (int s=0; s<n; s++) {
+        for (int k=0; k<rows[s].count; k++) {
+          raw_t *y = rows[s].data + k*p.totalchans;
+          for (int c=0; c<p.nchans; c++)
+            y[c] += basesub[c];
+        }
       }
+      basesubto = filledto;
     } else {
       basesubto = filledto;
     }
+    if (p.deadrange>=0) {
+      if (!warmedup && filledto >= from) {
+        deadchans.watch(inbufs[0], from);
+        deadchans.review(from, p.freq_hz);
+        warmedup = true;
+      }
+      deadchans.watch(inbufs[0], filledto);
+      deadchans.apply(fitters, processedto);
+    }
+    if (p.chanmajor) {
+      tochannels(inbufs[0], workin, p.nchans, CHANSTRIDE,
+                 transposedto, basesubto);
+      transposedto = basesubto;
+    }
+
+    // -- look for events in the new data
+    if (detector.active() && nextpeg==INFTY)
+      nextpeg = detector.scan(inbufs[0], filledto);
 
     // -- subtract artifacts
-    timeref_t mightprocessto = filledto
-      - nextforcepeg_sams - 3*p.tau_sams - 2;
+    timeref_t margin = nextforcepeg_sams + 3*p.tau_sams + 2;
+    timeref_t mightprocessto = filledto > margin ? filledto - margin : 0;
     if (mightprocessto > savedto + BUFSAMS)
       mightprocessto = savedto + BUFSAMS;
+    if (detector.active() && nextpeg==INFTY
+        && mightprocessto > detector.settled())
+      mightprocessto = detector.settled();
     if (nextpeg + nextforcepeg_sams + 1 >= mightprocessto
         && nextpeg - p.tau_sams - 1 < mightprocessto)
       mightprocessto = nextpeg - p.tau_sams - 1;
+    /* Pause at FROM or TO, unless that lies where a forced peg is
+       due: the peg is then run across it, as in a single pass.
+    */
+    timeref_t mark = pastfrom ? to : from;
+    bool inpeg = mark + p.tau_sams + 1 >= nextpeg
+      && mark <= nextpeg + nextforcepeg_sams;
+    if (processedto < mark && mightprocessto > mark && !inpeg)
+      mightprocessto = mark;
     while (processedto < mightprocessto) {
       go_on=true;
       if (nextpeg < mightprocessto) {
         //std::cerr << "processing to peg at " << nextpeg << "\n";
         // process to upcoming peg
-        int step = p.nchans / p.nthreads;
-        if (step*p.nthreads < p.nchans)
-          step ++;
         timeref_t t1 = nextpeg;
         timeref_t t2 = nextpeg + nextforcepeg_sams;
-        for (int c0=0; c0<p.nchans; c0+=step) {
-          int c1 = c0 + step;
-          if (c1>p.nchans)
-            c1 = p.nchans;
-          std::packaged_task<void()> task([c0,c1,t1,t2,fitters]() {
-            for (int c=c0; c<c1; c++)
-              if (fitters[c]->forcepeg(t1, t2)!=t2)
-                crash("LocalFit unhappy");
-                                               });
-          pool.post(task);
-        }
-        // first, copy non-electrode channels
-        for (timeref_t tt=processedto; tt<nextpeg+nextforcepeg_sams; tt++)
-          for (int hw=p.nchans; hw<p.totalchans; hw++)
-            outbufs[hw][tt] = inbufs[hw][tt];
+        auto job = [&](int k) {
+          for (int n=split.next(k); n>=0; n=split.next(k)) {
+            int c0 = n*chunk;
+            int c1 = c0 + chunk < p.nchans ? c0 + chunk : p.nchans;
+            if (fitters.forcepeg(t1, t2, c0, c1)!=t2)
+              crash("LocalFit unhappy");
+          }
+        };
+        makeroom(t2);
+        split.reset();
+        pool.start(job);
+        // copy non-electrode channels
+        copyrows(inbufs[0], outbufs[0], processedto, nextpeg+nextforcepeg_sams,
+                 p.nchans, p.totalchans);
         pool.wait();
 
         processedto = nextpeg + nextforcepeg_sams;
         // find next peg
         if (p.period_sams) {
           nextpeg += p.period_sams;
+        } else if (detector.active()) {
+          detector.restart(processedto);
+          nextpeg = detector.scan(inbufs[0], filledto);
+          if (nextpeg==INFTY && mightprocessto > detector.settled())
+            mightprocessto = detector.settled();
         } else if (events) {
           if (std::fgets(linebuf, 99, events)) {
             linebuf[99] = 0;
             char const *spc = std::strchr(linebuf, ' ');
-            nextpeg = std::atoll(linebuf) - p.skip_count;
+            nextpeg = std::atoll(linebuf) - origin;
             if (spc) {
               while (*spc==32)
                 spc++;
@@ -435,37 +951,47 @@ int main(int argc, char **argv) {
         }
       } else {
         // process as far as we have loaded
-        int step = p.nchans / p.nthreads;
-        if (step*p.nthreads < p.nchans)
-          step ++;
         timeref_t t1 = mightprocessto;
-        for (int c0=0; c0<p.nchans; c0+=step) {
-          int c1 = c0 + step;
-          if (c1>p.nchans)
-            c1 = p.nchans;
-          std::packaged_task<void()> task([c0,c1,t1,fitters]() {
-            for (int c=c0; c<c1; c++)
-              if (fitters[c]->process(t1)!=t1)
-                crash("LocalFit unhappy");
-                                               });
-          pool.post(task);
-        }
+        auto job = [&](int k) {
+          for (int n=split.next(k); n>=0; n=split.next(k)) {
+            int c0 = n*chunk;
+            int c1 = c0 + chunk < p.nchans ? c0 + chunk : p.nchans;
+            if (fitters.process(t1, c0, c1)!=t1)
+              crash("LocalFit unhappy");
+          }
+        };
+        makeroom(t1);
+        split.reset();
+        pool.start(job);
         // copy non-electrode channels
-        for (timeref_t tt=processedto; tt<mightprocessto; tt++)
-          for (int hw=p.nchans; hw<p.totalchans; hw++)
-            outbufs[hw][tt] = inbufs[hw][tt];
+        copyrows(inbufs[0], outbufs[0], processedto, mightprocessto,
+                 p.nchans, p.totalchans);
         pool.wait();
         processedto = mightprocessto;
       }
+      passmarks();
     }
 
     // -- load some data
-    if (!at_eof) {
-      int n = std::fread(&inbufs[0][filledto],
-                         sizeof(raw_t)*p.totalchans, FRAGSAMS,
-                         in);
-      if (n<0) 
-        crash("Cannot read from input");
+    timeref_t keep = processedto > HISTORY ? processedto - HISTORY : 0;
+    if (mapped)
+      mapped->discard(keep > timeref_t(BUFSAMS) ? (keep - BUFSAMS)*rowbytes : 0);
+    else
+      reader->release(keep);
+    if (!at_eof && processedto < to) {
+      timeref_t avail = mappedto;
+      while (!mapped) {
+        int rung = bell.peek();
+        bool eof = reader->eof();
+        avail = reader->filled();
+        if (eof || avail >= filledto + FRAGSAMS)
+          break;
+        if (reader->full(avail))
+          crash("Buffer too small for these parameters. Try a larger -S.");
+        bell.wait(rung);
+      }
+      int n = avail - filledto < timeref_t(FRAGSAMS)
+        ? int(avail - filledto) : FRAGSAMS;
       filledto += n;
       if (n>0)
         go_on=true;
@@ -474,52 +1000,471 @@ int main(int argc, char **argv) {
     }
   }
 
-  std::cerr << "salpa nearly done\n";
+  if (!done) {
+    if (chatty)
+      std::cerr << "salpa nearly done\n";
 
-  // -- EOF!
+    // -- EOF!
 
-  //std::cerr << "go_on\n" << savedto << " " << processedto << " "
-  //          << filledto << " " << nextpeg << " " << events << "\n";
-  //fitters[0]->report();
-  
-  // let's process the last bit...
-  timeref_t mightprocessto = filledto - p.tau_sams - 1;
-  if (mightprocessto > nextpeg - p.tau_sams - 1)
-    mightprocessto = nextpeg - p.tau_sams - 1;
-  for (timeref_t tt=processedto; tt<mightprocessto; tt++)
-    for (int hw=p.nchans; hw<p.totalchans; hw++)
-      outbufs[hw][tt] = inbufs[hw][tt];
-  for (int hw=0; hw<p.nchans; hw++) 
-    if (fitters[hw]->process(mightprocessto) != mightprocessto)
+    //std::cerr << "go_on\n" << savedto << " " << processedto << " "
+    //          << filledto << " " << nextpeg << " " << events << "\n";
+    //fitters.report(0);
+
+    // let's process the last bit...
+    if (mapped) {
+      /* LocalFit looks a little beyond the end of the data as it
+         finishes. In a ring buffer, it finds the scans from one ring
+         earlier there; with mapped input, it gets the same, so that the
+         output does not depend on how the input was read.
+      */
+      for (timeref_t t=filledto; t<filledto+BUFSAMS; t++)
+        if (t >= timeref_t(BUFSAMS))
+          std::copy(&inbufs[0][t-BUFSAMS], &inbufs[0][t-BUFSAMS] + p.totalchans,
+                    &inbufs[0][t]);
+    }
+    makeroom(filledto);
+    timeref_t mightprocessto = filledto - p.tau_sams - 1;
+    if (mightprocessto > nextpeg - p.tau_sams - 1)
+      mightprocessto = nextpeg - p.tau_sams - 1;
+    copyrows(inbufs[0], outbufs[0], processedto, mightprocessto,
+             p.nchans, p.totalchans);
+    if (fitters.process(mightprocessto) != mightprocessto)
       crash("LocalFit doesn't like my data!");
-  processedto = mightprocessto;
-  if (nextpeg > filledto)
-    nextpeg = filledto;
-  mightprocessto = filledto;
-  for (timeref_t tt=processedto; tt<mightprocessto; tt++)
-    for (int hw=p.nchans; hw<p.totalchans; hw++)
-      outbufs[hw][tt] = inbufs[hw][tt];
-  for (int hw=0; hw<p.nchans; hw++) 
-    if (fitters[hw]->forcepeg(nextpeg, mightprocessto)
-        != mightprocessto)
+    processedto = mightprocessto;
+    if (nextpeg > filledto)
+      nextpeg = filledto;
+    mightprocessto = filledto;
+    copyrows(inbufs[0], outbufs[0], processedto, mightprocessto,
+             p.nchans, p.totalchans);
+    if (fitters.forcepeg(nextpeg, mightprocessto) != mightprocessto)
       crash("LocalFit doesn't like my data!");
-  processedto = mightprocessto;
+    processedto = mightprocessto;
 
-  std::cerr << "salpa saving last bit\n";
-  
-  // let's save last bit
-  const int BUFMASK = BUFSAMS - 1;
-  while (savedto<processedto) {
-    //std::cerr << "go_on\n" << savedto << " " << processedto << " "
-    //          << filledto << " " << nextpeg << " " << events << "\n";
-    int bufidx = savedto & BUFMASK;
-    timeref_t saveto = savedto + BUFSAMS - bufidx;
-    if (saveto>processedto)
-      saveto = processedto;
-    std::fwrite(&outbufs[0][savedto],
-                sizeof(raw_t)*p.totalchans, saveto-savedto,
-                out);
-    savedto = saveto;
+    if (chatty)
+      std::cerr << "salpa saving last bit\n";
+    if (p.chanmajor)
+      toscans(workout, outbufs[0], p.nchans, CHANSTRIDE,
+              untransposedto, processedto);
+
+    // let's save last bit
+    writer.finish(processedto < to ? processedto : to);
+    passmarks();
+  }
+  if (!pastfrom)
+    snapshot(res.atfrom, from);
+  if (!pastto)
+    snapshot(res.atto, to);
+
+  if (events)
+    std::fclose(events);
+  res.everdead.resize(p.nchans);
+  for (int c=0; c<p.nchans; c++)
+    res.everdead[c] = deadchans.everdead(c);
+}
+
+std::string shellquote(std::string const &s) {
+  // Quotes S for the shell, unless it does not need it.
+  if (!s.empty()
+      && s.find_first_not_of("abcdefghijklmnopqrstuvwxyz"
+                             "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                             "0123456789-_.,:/=+") == std::string::npos)
+    return s;
+  std::string q = "'";
+  for (char c: s)
+    q += c=='\'' ? std::string("'\\''") : std::string(1, c);
+  return q + "'";
+}
+
+std::string chanmapspec(std::vector<char> const &roles) {
+  // Writes per-channel ROLES ('f', 'p', or 'd') as a list for -m.
+  std::ostringstream s;
+  for (unsigned c=0; c<roles.size(); ) {
+    unsigned n = 1;
+    while (c+n<roles.size() && roles[c+n]==roles[c])
+      n++;
+    s << (c ? "," : "") << c;
+    if (n>1)
+      s << "-" << c+n-1;
+    s << ":" << roles[c];
+    c += n;
+  }
+  return s.str();
+}
+
+int plan(Params const &p, int argc, char **argv, char const *prog) {
+  /* Writes a shell script to stdout that runs salpa on shards of the
+     recording, -G groups of fitted channels by -J stretches of time,
+     and that tells salpa merge how to put the output together (see
+     Shards.h). The channels that are passed through go with the first
+     group; a trigger channel (-E) goes with every group. Each stretch
+     of time is a segment as for -J, given to its shards as -I, and
+     gets the part of the -P file that it needs.
+  */
+  if (!p.input_filename || !p.output_filename)
+    crash("salpa plan needs -i and -o");
+  if (p.ngroups>1 && p.consensus_count>0)
+    crash("Events by consensus (-K) cannot be split into channel groups");
+  const int FRAGSAMS = (1<<p.log2bufsize) / 4;
+  const std::uint64_t filebytes = sizeof(raw_t)*p.chanmap.filecount();
+  timeref_t total = filelength(p.input_filename) / filebytes;
+  total = total > p.skip_count ? total - p.skip_count : 0;
+  if (p.limit_count>0 && p.limit_count<total)
+    total = p.limit_count;
+  if (total < timeref_t(p.nsegments))
+    crash("Not enough data in input file");
+  std::string output = p.output_filename;
+
+  // What each channel in the file is, and where it goes in the output
+  int nfile = p.chanmap.filecount();
+  std::vector<char> roles(nfile);
+  std::vector<int> outcol(nfile, -1);
+  for (int c=0, j=0; c<nfile; c++) {
+    int s = p.chanmap.slot(c);
+    roles[c] = s<0 ? 'd' : s<p.nchans ? 'f' : 'p';
+    if (s>=0)
+      outcol[c] = j++;
+  }
+  int trigger = p.trigger_chan>=0 ? p.chanmap.filechannel(p.trigger_chan) : -1;
+
+  // The arguments that all shards share. Mapped input (-R) needs all
+  // channels, so it is dropped for channel groups.
+  std::string common = shellquote(prog);
+  bool subsets = p.forcepeg_filename && p.nsegments>1;
+  for (int k=1; k<argc; k++) {
+    char letter = argv[k][1];
+    bool hasarg = !(argv[k][2]>=32 || letter=='B' || letter=='Z'
+                    || letter=='X' || letter=='H' || letter=='R');
+    bool keep = std::strchr("GJcCmoNQDI", letter)==0
+      && !(letter=='P' && subsets)
+      && !(letter=='R' && p.ngroups>1);
+    if (keep)
+      common += " " + shellquote(argv[k]);
+    if (hasarg) {
+      k++;
+      if (keep)
+        common += " " + shellquote(argv[k]);
+    }
+  }
+  common += " -C " + std::to_string(nfile);
+
+  ShardPlan plan;
+  plan.output = output;
+  plan.ncolumns = p.totalchans;
+  plan.nscans = total;
+  std::cout << "#!/bin/sh\n"
+            << "# salpa plan: " << p.ngroups << " channel group(s) by "
+            << p.nsegments << " stretch(es) of time, " << total << " scans\n"
+            << "# The shards may run in any order, as separate processes or"
+            << " on separate\n"
+            << "# machines that see the same files. When all are done, run"
+            << " salpa merge\n"
+            << "# with this script as its argument.\n"
+            << plan.outputline() << "\n";
+  for (int k=0; k<p.nsegments; k++) {
+    Segment seg = segment(total*k/p.nsegments, total*(k+1)/p.nsegments,
+                          p.warmup_sams, FRAGSAMS);
+    std::string events;
+    if (subsets) {
+      // The events from the start of the segment up to its end
+      events = output + ".s" + std::to_string(k) + ".events";
+      FILE *src = std::fopen(p.forcepeg_filename, "r");
+      FILE *dst = std::fopen(events.c_str(), "w");
+      if (!src || !dst)
+        crash("Cannot write timestamp file");
+      char linebuf[100];
+      while (std::fgets(linebuf, 99, src)) {
+        linebuf[99] = 0;
+        timeref_t t = std::atoll(linebuf);
+        if (t >= p.skip_count + seg.start && t < p.skip_count + seg.end)
+          std::fputs(linebuf, dst);
+      }
+      std::fclose(src);
+      if (std::fclose(dst) != 0)
+        crash("Cannot write timestamp file");
+    }
+    for (int g=0; g<p.ngroups; g++) {
+      int s0 = p.nchans*g/p.ngroups;
+      int s1 = p.nchans*(g+1)/p.ngroups;
+      std::vector<char> myroles(nfile, 'd');
+      Shard sh;
+      sh.file = output + ".g" + std::to_string(g) + ".s" + std::to_string(k);
+      sh.from = seg.from;
+      sh.to = seg.to;
+      for (int c=0; c<nfile; c++) {
+        int s = p.chanmap.slot(c);
+        bool mine = roles[c]=='f' ? s>=s0 && s<s1 : roles[c]=='p' && g==0;
+        if (mine || c==trigger) {
+          myroles[c] = roles[c];
+          sh.columns.push_back(mine ? outcol[c] : -1);
+        }
+      }
+      plan.shards.push_back(sh);
+      std::cout << ShardPlan::shardline(sh) << "\n"
+                << common
+                << " -m " << shellquote(chanmapspec(myroles))
+                << " -I " << sh.from << "," << sh.to;
+      if (subsets)
+        std::cout << " -P " << shellquote(events);
+      std::cout << " -o " << shellquote(sh.file) << "\n";
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if ((INFTY + 1) != 0) {
+    crash("BUG: Infinity isn't.");
+    return 2;
+  }
+  if (argc>1 && std::strcmp(argv[1], "merge")==0) {
+    ShardPlan plan;
+    if (argc!=3)
+      usage();
+    if (!plan.read(argv[2]) || !plan.merge())
+      return 2;
+    return 0;
+  }
+  char const *prog = argv[0];
+  bool planning = argc>1 && std::strcmp(argv[1], "plan")==0;
+  if (planning) {
+    argc--;
+    argv++;
+  }
+  Params p;
+  if (!p.fromArgs(argc, argv)) {
+    usage();
+    return 1;
+  }
+
+  if (p.thresh_digi!=0 && p.thresh_std!=0) {
+    usage();
+    return 1;
+  }
+
+  if (planning)
+    return plan(p, argc, argv, prog);
+  if (p.ngroups>1) {
+    std::cerr << "Channel groups (-G) are only for salpa plan\n";
+    usage();
+    return 1;
+  }
+
+  FILE *in = p.input_filename
+    ? std::fopen(p.input_filename, "rb")
+    : std::freopen(0, "rb", stdin);
+  if (!in)
+    crash("Cannot open input file");
+
+  FILE *out = p.output_filename
+    ? std::fopen(p.output_filename, "wb")
+    : std::freopen(0, "wb", stdout);
+  if (!out)
+    crash("Cannot open output file");
+
+  const std::uint64_t filebytes = sizeof(raw_t)*p.chanmap.filecount();
+  const std::uint64_t outbytes = sizeof(raw_t)*p.chanmap.keepcount();
+  std::uint64_t skip = p.skip_count;
+  skip *= filebytes;
+  std::cerr << "SALPA says hello\n" << "skip = " << skip << " " << sizeof(skip) << "\n";
+  if (!seekahead(in, skip)) {
+    std::cerr << "FSEEK FAILED: " << strerror(errno) << "\n";
+    return 2;
+  }
+
+  const int BUFSAMS = 1<<p.log2bufsize;
+  const int FRAGSAMS = BUFSAMS / 4;
+
+  /* The noise estimate is made once, on the start of the recording,
+     even with -J. Those scans are kept in HEAD, in salpa's own layout,
+     and the first segment starts from them.
+  */
+  std::vector<float> thresh(p.nchans, p.thresh_digi);
+  std::vector<raw_t> basesub(p.nchans, 0);
+  std::vector<raw_t> head;
+  int nhead = 0;
+
+  if (p.thresh_std!=0 || p.basesub) {
+      std::cerr << "salpa estimating noise\n";
+    head.resize(std::size_t(BUFSAMS)*p.totalchans);
+    int n;
+    if (p.chanmap.identity()) {
+      n = std::fread(head.data(),
+                     p.totalchans*sizeof(raw_t), 3*FRAGSAMS,
+                     in);
+    } else {
+      std::vector<raw_t> scans(3*FRAGSAMS*p.chanmap.filecount());
+      n = std::fread(scans.data(),
+                     p.chanmap.filecount()*sizeof(raw_t), 3*FRAGSAMS,
+                     in);
+      p.chanmap.unpack(scans.data(), head.data(), p.totalchans, n);
+    }
+    if (n != 3*FRAGSAMS)
+      crash("Cannot read enough data for noise estimate");
+    nhead = n;
+    for (int c=0; c<p.nchans; c++) {
+      NoiseLevels noise;
+      noise.train(CyclBuf<raw_t>(head.data() + c, p.log2bufsize,
+                                 p.totalchans), 0, n);
+      noise.makeready();
+      if (p.thresh_std!=0)
+        thresh[c] = p.thresh_std * noise.std();
+      if (p.basesub)
+        basesub[c] = -noise.mean();
+    }
+  }
+
+  // With -H, each thread is pinned.
+  std::vector<int> cpus;
+  if (p.placement) {
+    Topology topo;
+    cpus = topo.spread(p.nthreads);
+    std::cerr << "salpa pinning " << p.nthreads << " threads on "
+              << topo.cpucount() << " cpus in "
+              << topo.nodecount() << " NUMA node(s)\n";
+  }
+
+  std::vector<Segment> segs;
+  std::vector<Outcome> outcomes;
+  if (p.nsegments==1 && p.interval_to==0) {
+    Segment seg = { 0, INFTY, 0, INFTY };
+    segs.push_back(seg);
+    outcomes.resize(1);
+    runsegment(p, seg, in, out, head, nhead, thresh, basesub,
+               p.nthreads, cpus, true, outcomes[0]);
+  } else {
+    /* With -J, the segments are processed at the same time, each with
+       its own share of the threads, reading from and writing to its
+       own place in the files. Each starts -W before the scans it
+       writes out and runs -W past them, to warm up the fitters and to
+       leave room for pegs in progress. -N is handled here rather than
+       by the segments themselves, so that the output is exactly that
+       long. With -I, there is only the one segment, and the output
+       starts where it does.
+    */
+    std::fclose(in);
+    std::fclose(out);
+    timeref_t total = filelength(p.input_filename) / filebytes;
+    total = total > p.skip_count ? total - p.skip_count : 0;
+    if (p.limit_count>0 && p.limit_count<total)
+      total = p.limit_count;
+    const timeref_t W = p.warmup_sams;
+    for (int k=0; k<p.nsegments; k++) {
+      Segment seg = p.interval_to
+        ? segment(p.interval_from, p.interval_to, W, FRAGSAMS)
+        : segment(total*k/p.nsegments, total*(k+1)/p.nsegments, W, FRAGSAMS);
+      if (k==p.nsegments-1 && p.limit_count==0 && p.interval_to==0)
+        seg.to = seg.end = INFTY;
+      segs.push_back(seg);
+    }
+    outcomes.resize(p.nsegments);
+    Params q = p;
+    q.limit_count = 0;
+    if (p.interval_to)
+      std::cerr << "salpa processing scans " << p.interval_from
+                << " up to " << p.interval_to << "\n";
+    else
+      std::cerr << "salpa processing " << p.nsegments << " segments of about "
+                << total/p.nsegments << " scans\n";
+    std::vector<std::thread> runs;
+    for (int k=0; k<p.nsegments; k++) {
+      int t0 = p.nthreads*k/p.nsegments;
+      int t1 = p.nthreads*(k+1)/p.nsegments;
+      int nthreads = t1>t0 ? t1 - t0 : 1;
+      std::vector<int> mycpus;
+      if (t1>t0 && !cpus.empty())
+        mycpus = std::vector<int>(cpus.begin() + t0, cpus.begin() + t1);
+      runs.push_back(std::thread([&, k, nthreads, mycpus]() {
+        Segment const &seg = segs[k];
+        int myhead = seg.start==0 ? nhead : 0;
+        FILE *in = std::fopen(p.input_filename, "rb");
+        if (!in || !seekahead(in, (p.skip_count + seg.start + myhead)
+                              * filebytes))
+          crash("Cannot open input file");
+        FILE *out = std::fopen(p.output_filename, "r+b");
+        if (!out || !seekahead(out, (seg.from - segs[0].from)*outbytes))
+          crash("Cannot open output file");
+        runsegment(q, seg, in, out, head, myhead, thresh, basesub,
+                   nthreads, mycpus, k==0, outcomes[k]);
+        std::fclose(in);
+        if (std::fclose(out) != 0)
+          crash("Cannot write output file");
+      }));
+    }
+    for (std::thread &thr: runs)
+      thr.join();
+
+    /* Once a channel is in the same steady state at a boundary in
+       both segments (OK or PEGGED), it carries on there as in a single
+       pass, so its output is the same. Where a channel is caught in an
+       artifact at a boundary, the difference is confined to that
+       artifact. A channel that is dead in both counts as settled, one
+       that is dead in only one of them does not. (Either way, dead
+       channels may come out differently elsewhere; see -V.)
+    */
+    for (int k=1; k<p.nsegments; k++) {
+      Outcome::Snapshot const &a = outcomes[k-1].atto;
+      Outcome::Snapshot const &b = outcomes[k].atfrom;
+      int n = 0;
+      for (int c=0; c<p.nchans; c++) {
+        LocalFitBank::State s = a.states[c];
+        bool dead = s==LocalFitBank::State::DEAD;
+        bool steady = s==LocalFitBank::State::OK
+          || s==LocalFitBank::State::PEGGED;
+        if (dead != (b.states[c]==LocalFitBank::State::DEAD))
+          n++;
+        else if (!dead && (!a.exact || !b.exact || b.states[c]!=s || !steady))
+          n++;
+      }
+      std::cerr << "salpa segment boundary at scan " << segs[k].from
+                << ": " << n << " channel(s) not settled\n";
+    }
+  }
+
+  // The counters are summed over the stretches that were written out.
+  std::vector<LocalFitBank::Stats> stats(p.nchans);
+  timeref_t nsams = 0;
+  for (Outcome const &res: outcomes) {
+    nsams += res.atto.t - res.atfrom.t;
+    for (int c=0; c<p.nchans; c++) {
+      LocalFitBank::Stats const &a = res.atfrom.stats[c];
+      LocalFitBank::Stats const &b = res.atto.stats[c];
+      LocalFitBank::Stats &st = stats[c];
+      for (int s=0; s<LocalFitBank::NSTATES; s++)
+        st.samples[s] += b.samples[s] - a.samples[s];
+      st.pegs += b.pegs - a.pegs;
+      st.forcepegs += b.forcepegs - a.forcepegs;
+      st.retries += b.retries - a.retries;
+      st.blanked += b.blanked - a.blanked;
+      st.sumsq_in += b.sumsq_in - a.sumsq_in;
+      st.sumsq_out += b.sumsq_out - a.sumsq_out;
+    }
+  }
+
+  std::string qcfn = p.qc_filename ? p.qc_filename
+    : p.output_filename ? std::string(p.output_filename) + ".qc.json"
+    : "";
+  if (!qcfn.empty())
+    writeqc(qcfn.c_str(), stats, p.chanmap, thresh, nsams);
+  if (p.trace_filename) {
+    std::vector<int> filechans;
+    for (int c=0; c<p.nchans; c++)
+      filechans.push_back(p.chanmap.filechannel(c));
+    if (!Trace::save(p.trace_filename, filechans))
+      crash("Cannot write trace file");
+  }
+  std::vector<char> everdead(p.nchans, 0);
+  int ndead = 0;
+  for (int c=0; c<p.nchans; c++) {
+    for (Outcome const &res: outcomes)
+      everdead[c] |= res.everdead[c];
+    ndead += everdead[c];
+  }
+  if (ndead) {
+    std::cerr << "salpa treated " << ndead << " channel(s) as dead:";
+    for (int c=0; c<p.nchans; c++)
+      if (everdead[c])
+        std::cerr << " " << p.chanmap.filechannel(c);
+    std::cerr << "\n";
   }
   std::cerr << "salpa all the way done";
   return 0;
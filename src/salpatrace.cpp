@@ -0,0 +1,104 @@
+// salpatrace.cpp
+
+/* Converts a trace file written by "salpa -D" to CSV, one line per
+   state transition, with columns t, channel, event, value, thread.
+   Records are sorted by time and then channel, so the output reads as
+   one timeline regardless of which thread processed which channel.
+*/
+
+#include "Trace.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+void usage() {
+  std::cerr
+    << "Usage: salpa-trace [-c channel] [-e event] [-i input_file] [-o output_file]\n"
+    << "\n"
+    << "Converts a trace file written by salpa -D to CSV.\n"
+    << "-c only reports transitions on the given channel.\n"
+    << "-e only reports events of the given kind: PEG, FORCEPEG, REPEG,\n"
+    << "   TOOPOOR, RETRY, DEPEG, or RESUME.\n"
+    << "-i and -o specify input and output filenames. If not given,\n"
+    << "   stdin/stdout are used.\n";
+  exit(1);
+}
+
+void crash(char const *x) {
+  std::cerr << x << "\n";
+  std::exit(2);
+}
+
+int main(int argc, char **argv) {
+  int channel = -1;
+  int kind = -1;
+  char const *input_filename = 0;
+  char const *output_filename = 0;
+  while (argc>1) {
+    argc--;
+    argv++;
+    if (argv[0][0]!='-' || argc<2)
+      usage();
+    char letter = argv[0][1];
+    argc--;
+    argv++;
+    char const *arg = argv[0];
+    switch (letter) {
+    case 'c': channel = atoi(arg); break;
+    case 'e':
+      for (int k=0; k<int(TraceKind::NKINDS); k++)
+        if (std::strcmp(arg, Trace::kindName(TraceKind(k)))==0)
+          kind = k;
+      if (kind<0)
+        usage();
+      break;
+    case 'i': input_filename = arg; break;
+    case 'o': output_filename = arg; break;
+    default: usage();
+    }
+  }
+
+  FILE *in = input_filename
+    ? std::fopen(input_filename, "rb")
+    : std::freopen(0, "rb", stdin);
+  if (!in)
+    crash("Cannot open input file");
+  FILE *out = output_filename
+    ? std::fopen(output_filename, "w")
+    : stdout;
+  if (!out)
+    crash("Cannot open output file");
+
+  TraceHeader hdr;
+  if (std::fread(&hdr, sizeof(hdr), 1, in) != 1
+      || std::memcmp(hdr.magic, "SALPATRC", 8) != 0)
+    crash("Not a salpa trace file");
+  if (hdr.version != Trace::VERSION || hdr.recordsize != sizeof(TraceEvent))
+    crash("Unsupported trace file version");
+  if (hdr.dropped)
+    std::cerr << "salpa-trace: " << hdr.dropped
+              << " early records were lost to ring overflow\n";
+
+  std::vector<TraceEvent> events;
+  TraceEvent e;
+  while (std::fread(&e, sizeof(e), 1, in) == 1)
+    if ((channel<0 || e.channel==channel) && (kind<0 || e.kind==kind))
+      events.push_back(e);
+  std::stable_sort(events.begin(), events.end(),
+                   [](TraceEvent const &a, TraceEvent const &b) {
+                     return a.t < b.t || (a.t==b.t && a.channel < b.channel);
+                   });
+
+  std::fprintf(out, "t,channel,event,value,thread\n");
+  for (TraceEvent const &e: events)
+    std::fprintf(out, "%llu,%i,%s,%g,%u\n",
+                 (unsigned long long)e.t, int(e.channel),
+                 Trace::kindName(TraceKind(e.kind)),
+                 double(e.value), unsigned(e.thread));
+  if (out!=stdout && std::fclose(out)!=0)
+    crash("Cannot write output file");
+  return 0;
+}
@@ -0,0 +1,39 @@
+#!/usr/bin/python3
+
+# Compares salpa's interleaved working buffers against the channel-major
+# ones selected by -X: times both on the same input and checks that the
+# outputs are identical.
+#
+# Usage: test/benchlayout.py input.dat nchans [extra salpa args...]
+
+import os
+import sys
+import time
+import filecmp
+import subprocess
+
+ifn = sys.argv[1]
+C = sys.argv[2]
+extra = sys.argv[3:]
+salpa = "build/salpa"
+reps = 3
+
+def run(args, ofn):
+    best = None
+    for k in range(reps):
+        t0 = time.perf_counter()
+        subprocess.run([salpa, "-c", C, "-i", ifn, "-o", ofn] + args + extra,
+                       check=True, stderr=subprocess.DEVNULL)
+        dt = time.perf_counter() - t0
+        if best is None or dt < best:
+            best = dt
+    return best
+
+MB = os.path.getsize(ifn) / 1e6
+t_il = run([], "/tmp/salpa-interleaved.dat")
+t_cm = run(["-X"], "/tmp/salpa-chanmajor.dat")
+print(f"interleaved:   {t_il:.3f} s ({MB/t_il:.0f} MB/s)")
+print(f"channel-major: {t_cm:.3f} s ({MB/t_cm:.0f} MB/s)")
+same = filecmp.cmp("/tmp/salpa-interleaved.dat", "/tmp/salpa-chanmajor.dat",
+                   shallow=False)
+print("outputs identical" if same else "OUTPUTS DIFFER")
@@ -0,0 +1,56 @@
+#!/usr/bin/python3
+
+# Checks that processing in segments (-J) and intervals (-I) gives the
+# same output as a single pass, with forced pegs (-P) placed just
+# before, at, and just after the segment boundaries, so that the
+# fitters are in the middle of a peg there. Assumes the default tau of
+# 3 ms at 30 kHz.
+#
+# Usage: test/checksegments.py input.dat nchans totalchans [extra salpa args...]
+
+import os
+import sys
+import filecmp
+import subprocess
+
+ifn = sys.argv[1]
+C = sys.argv[2]
+CT = sys.argv[3]
+extra = sys.argv[4:]
+salpa = "build/salpa"
+J = 4
+tmp = "/tmp/salpa-segments"
+
+scans = os.path.getsize(ifn) // (2 * int(CT))
+bounds = [scans * k // J for k in range(1, J)]
+offsets = [-60, 0, 60] # within tau of the boundary, on either side
+
+with open(tmp + ".events", "w") as f:
+    for k, b in enumerate(bounds):
+        f.write(f"{b + offsets[k % len(offsets)]}\n")
+
+def run(args, ofn):
+    subprocess.run([salpa, "-c", C, "-C", CT, "-i", ifn, "-o", ofn,
+                    "-P", tmp + ".events", "-f", "3"] + args + extra,
+                   check=True, stderr=subprocess.DEVNULL)
+
+def scansof(fn, a, b):
+    rowbytes = 2 * int(CT)
+    with open(fn, "rb") as f:
+        f.seek(a * rowbytes)
+        return f.read((b - a) * rowbytes)
+
+ok = True
+run([], tmp + ".single")
+run(["-J", str(J)], tmp + ".split")
+same = filecmp.cmp(tmp + ".single", tmp + ".split", shallow=False)
+print(f"-J {J}: " + ("identical" if same else "DIFFERENT"))
+ok = ok and same
+for b in bounds:
+    for a, z in [(0, b), (b, scans)]:
+        run(["-I", f"{a},{z}"], tmp + ".interval")
+        with open(tmp + ".interval", "rb") as f:
+            same = f.read() == scansof(tmp + ".single", a, z)
+        print(f"-I {a},{z}: " + ("identical" if same else "DIFFERENT"))
+        ok = ok and same
+sys.exit(0 if ok else 1)